@@ -5,6 +5,8 @@
 #include <AsyncJson.h>
 #include <ArduinoJson.h>
 #include <AccelStepper.h>
+#include <Preferences.h>
+#include <Backlash.h>
 
 #define MICROSTEPS 16
 /* The gear ratio of the stepper to focuser. 3 means 3 stepper rotations to one focuser rotation */
@@ -17,6 +19,8 @@
 #define SECONDS_PER_REV 3
 #define MAXSPEED (STEPS_PER_REV / SECONDS_PER_REV)
 #define ACCELERATION 500
+/* The far end of the focuser's travel in steps, where a jog out stops */
+#define MAXSTEP 10000
 
 /*How long wait after motion is stopped to disable stepper */
 #define SETTLE_MS 500
@@ -31,9 +35,46 @@
 #define STEP_PIN 17
 #define DIR_PIN 16
 
+/* Optional timing instrumentation: a log2 histogram of the time between passes through loop(), where
+ * bucket 0 counts times under 1us, bucket n those from 2^(n-1) up to 2^n us and the last bucket everything
+ * longer, the longest loop, and how often a loop took longer than the step interval while moving.
+ * GET /api/v1/focuser/0/instrumentation returns it, PUT clears it.
+ */
+//#define INSTRUMENT 16
+
+/* Optional DS18B20 temperature sensor pin. Without it there is no temperature compensation. */
+//#define ONE_WIRE_BUS 4
+
+/* Temperature compensation, turned on and off with PUT /api/v1/focuser/0/tempcomp. While it is on and
+ * the focuser is otherwise idle, it moves TEMP_COEFFICIENT steps out for every degree C the temperature
+ * rises from when it was turned on or last moved, whenever that comes to at least TEMP_COMP_DEADBAND steps.
+ */
+#define TEMP_COEFFICIENT 2
+#define TEMP_COMP_DEADBAND 1
+
+/* Backlash compensation: moves finish in BACKLASH_DIRECTION, 1 for outwards, -1 inwards or 0 to go straight
+ * to the target. A move that would finish the other way overshoots the target by BACKLASH_STEPS and comes back.
+ * These are the defaults for the settings kept in NVS, changed with PUT /api/v1/focuser/0/backlash.
+ */
+#define BACKLASH_DIRECTION 0
+#define BACKLASH_STEPS 10
+
+/* Keep the position in NVS each time the motor settles, so a reset does not lose it. NVS spreads its
+ * writes over the flash pages it has itself, so this is one key rather than a ring of them.
+ * Comment out to start at 0 every reset.
+ */
+#define SAVE_POSITION
+
+#ifdef ONE_WIRE_BUS
+#include <OneWire.h>
+#include <DallasTemperature.h>
+#include <TempComp.h>
+#endif
+
 void setupWifi();
 void setupServer();
 void setupStepper();
+void setupTemperature();
 
 void setup()
 {
@@ -41,6 +82,9 @@ void setup()
   setupWifi();
   setupServer();
   setupStepper();
+#ifdef ONE_WIRE_BUS
+  setupTemperature();
+#endif
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -50,6 +94,227 @@ void setup()
 long millisLastMove = 0;
 long millisLastPrint = 0;
 AccelStepper stepper(AccelStepper::DRIVER, STEP_PIN, DIR_PIN);
+// Moves go through backlash, so they finish from the configured side
+Backlash<AccelStepper> backlash(stepper);
+Preferences preferences;
+#ifdef SAVE_POSITION
+long savedPosition = 0;
+#endif
+
+#ifdef INSTRUMENT
+uint32_t loopHistogram[INSTRUMENT];
+unsigned long maxLoop = 0;
+unsigned long slowLoops = 0;
+unsigned long missedSteps = 0;
+unsigned long lastLoop = 0;
+// Set by the web server, which runs in another task, and acted on by loop(). Starts set so that
+// the time spent in setup() is not counted as a loop.
+volatile bool instrumentReset = true;
+
+void instrumentLoop()
+{
+  unsigned long now = micros();
+  unsigned long took = now - lastLoop;
+  lastLoop = now;
+  if (instrumentReset)
+  {
+    memset(loopHistogram, 0, sizeof(loopHistogram));
+    maxLoop = 0;
+    slowLoops = 0;
+    missedSteps = 0;
+    instrumentReset = false;
+    return;
+  }
+
+  if (took > maxLoop)
+  {
+    maxLoop = took;
+  }
+  uint8_t bucket = 0;
+  for (unsigned long t = took; t && bucket < INSTRUMENT - 1; t >>= 1)
+  {
+    bucket++;
+  }
+  loopHistogram[bucket]++;
+
+  // AccelStepper takes at most one step per run() and times the next one from when it took it,
+  // so a loop longer than the step interval delays a step, and each further interval loses one
+  float speed = fabs(stepper.speed());
+  if (stepper.distanceToGo() && speed > 0)
+  {
+    unsigned long interval = 1000000.0 / speed;
+    if (took > interval)
+    {
+      slowLoops++;
+      missedSteps += took / interval - 1;
+    }
+  }
+}
+#endif
+
+#ifdef ONE_WIRE_BUS
+OneWire oneWire(ONE_WIRE_BUS);
+DallasTemperature sensors(&oneWire);
+TempComp tempComp(TEMP_COEFFICIENT, TEMP_COMP_DEADBAND);
+// Written by the temperature task and read by loop() and the web server
+volatile int16_t sensorTemp = 0; // 1/128 degrees C
+volatile uint32_t sensorReadings = 0;
+uint32_t readingsUsed = 0;
+// Set by the web server, and acted on by loop()
+volatile bool tempCompOn = false;
+
+// Reads the first sensor over and over. DallasTemperature waits out each conversion, which
+// in a task of its own only holds up this task, not loop() and the steps.
+void temperatureTask(void *parameter)
+{
+  DeviceAddress address;
+  sensors.begin();
+  if (!sensors.getAddress(address, 0))
+  {
+    Serial.println("No temperature sensor");
+    vTaskDelete(NULL);
+  }
+  for (;;)
+  {
+    sensors.requestTemperatures();
+    int32_t raw = sensors.getTemp(address);
+    if (raw != DEVICE_DISCONNECTED_RAW)
+    {
+      sensorTemp = raw;
+      sensorReadings++;
+    }
+    delay(250);
+  }
+}
+
+void setupTemperature()
+{
+  // On the core loop() does not run on
+  xTaskCreatePinnedToCore(temperatureTask, "temperature", 2048, NULL, 1, NULL, 0);
+}
+
+void temperatureCompensation()
+{
+  if (tempCompOn != tempComp.enabled())
+  {
+    tempComp.setEnabled(tempCompOn);
+  }
+  if (sensorReadings != readingsUsed)
+  {
+    readingsUsed = sensorReadings;
+    tempComp.addSample(sensorTemp);
+  }
+
+  // Only while nothing else is moving the focuser
+  if (!stepper.isRunning() && !backlash.isRunning())
+  {
+    long steps = tempComp.correction();
+    if (steps)
+    {
+      tempComp.applied(steps);
+      stepper.setMaxSpeed(MAXSPEED);
+      stepper.enableOutputs();
+      backlash.moveTo(stepper.currentPosition() + steps * MICROSTEPS);
+    }
+  }
+}
+#endif
+
+// Requests from the web server, which runs in another task. The handlers only post them here and loop()
+// applies them, so only loop() touches the stepper and backlash. A request is posted and taken whole under
+// requestMux, and replaces any not yet taken.
+#define REQUEST_NONE 0
+#define REQUEST_MOVE 1 // to requestArgument steps, or by it from the target if requestRelative
+#define REQUEST_JOG 2  // at requestArgument steps a second, out if positive or in if negative, 0 to stop
+#define REQUEST_HALT 3
+volatile uint8_t motionRequest = REQUEST_NONE;
+volatile long requestArgument = 0;
+volatile bool requestRelative = false;
+// The backlash settings, read back by the web server
+volatile bool backlashChanged = false;
+volatile int8_t backlashDirection = BACKLASH_DIRECTION;
+volatile long backlashOvershoot = BACKLASH_STEPS * MICROSTEPS;
+portMUX_TYPE requestMux = portMUX_INITIALIZER_UNLOCKED;
+
+void postMotion(uint8_t request, long argument = 0, bool relative = false)
+{
+  portENTER_CRITICAL(&requestMux);
+  motionRequest = request;
+  requestArgument = argument;
+  requestRelative = relative;
+  portEXIT_CRITICAL(&requestMux);
+}
+
+void postBacklash(int8_t direction, long overshoot)
+{
+  portENTER_CRITICAL(&requestMux);
+  backlashDirection = direction;
+  backlashOvershoot = overshoot;
+  backlashChanged = true;
+  portEXIT_CRITICAL(&requestMux);
+}
+
+void applyRequests()
+{
+  portENTER_CRITICAL(&requestMux);
+  uint8_t request = motionRequest;
+  long argument = requestArgument;
+  bool relative = requestRelative;
+  bool changed = backlashChanged;
+  int8_t direction = backlashDirection;
+  long overshoot = backlashOvershoot;
+  motionRequest = REQUEST_NONE;
+  backlashChanged = false;
+  portEXIT_CRITICAL(&requestMux);
+
+  if (changed)
+  {
+    backlash.setDirection(direction);
+    backlash.setOvershoot(overshoot);
+  }
+
+  if (request == REQUEST_HALT)
+  {
+    backlash.cancel();
+    stepper.moveTo(stepper.currentPosition());
+    stepper.setMaxSpeed(1);
+    stepper.disableOutputs();
+    Serial.println("Halted");
+  }
+  else if (request == REQUEST_JOG && !argument)
+  {
+    backlash.stop(MICROSTEPS);
+    Serial.println("Jog stopping");
+  }
+  else if (request == REQUEST_JOG)
+  {
+    long position = stepper.currentPosition();
+    backlash.jog(argument > 0 ? max(position, (long)MAXSTEP * MICROSTEPS) : min(position, 0L),
+                 min(labs(argument), (long)MAXSPEED));
+    stepper.enableOutputs();
+#ifdef ONE_WIRE_BUS
+    tempComp.reference();
+#endif
+    Serial.print("Jogging at ");
+    Serial.println(argument / MICROSTEPS);
+  }
+  else if (request == REQUEST_MOVE)
+  {
+    if (relative)
+    {
+      argument += backlash.targetPosition();
+    }
+    stepper.setMaxSpeed(MAXSPEED);
+    stepper.enableOutputs();
+    backlash.moveTo(argument);
+#ifdef ONE_WIRE_BUS
+    // compensate from the new focus position
+    tempComp.reference();
+#endif
+    Serial.print("Moving to ");
+    Serial.println(backlash.targetPosition() / MICROSTEPS);
+  }
+}
 
 void setupStepper()
 {
@@ -60,6 +325,17 @@ void setupStepper()
   stepper.setPinsInverted(true, false, true);
   millisLastMove = millis();
 
+  preferences.begin("focuser");
+  backlashDirection = preferences.getChar("approach", BACKLASH_DIRECTION);
+  backlashOvershoot = preferences.getUShort("overshoot", BACKLASH_STEPS) * MICROSTEPS;
+  backlash.setDirection(backlashDirection);
+  backlash.setOvershoot(backlashOvershoot);
+#ifdef SAVE_POSITION
+  //Carry on from where the motor was before the reset
+  savedPosition = preferences.getLong("position", 0);
+  stepper.setCurrentPosition(savedPosition);
+#endif
+
 #ifdef MS1
   pinMode(MS1, OUTPUT);
   digitalWrite(MS1, HIGH);
@@ -92,11 +368,18 @@ void setupStepper()
 
 void loop()
 {
+#ifdef INSTRUMENT
+  instrumentLoop();
+#endif
+  applyRequests();
+#ifdef ONE_WIRE_BUS
+  temperatureCompensation();
+#endif
   long now = millis();
   //Motion Controll
   if (stepper.distanceToGo())
   {
-    if (stepper.run())
+    if (backlash.run())
     {
       millisLastMove = now;
     }
@@ -109,6 +392,14 @@ void loop()
     if ((now - millisLastMove) > SETTLE_MS)
     {
       stepper.disableOutputs();
+#ifdef SAVE_POSITION
+      // only when it has changed, not every loop
+      if (stepper.currentPosition() != savedPosition)
+      {
+        savedPosition = stepper.currentPosition();
+        preferences.putLong("position", savedPosition);
+      }
+#endif
     }
   }
 
@@ -190,31 +481,98 @@ void setupServer()
 
   //Focuser
   server.on("/api/v1/focuser/0/absolute", HTTP_GET, constant(true));
-  server.on("/api/v1/focuser/0/ismoving", HTTP_GET, producer([]() { return stepper.isRunning(); }));
+  server.on("/api/v1/focuser/0/ismoving", HTTP_GET, producer([]() { return motionRequest != REQUEST_NONE || stepper.isRunning() || backlash.isRunning(); }));
   server.on("/api/v1/focuser/0/maxincrement", HTTP_GET, constant(1000));
-  server.on("/api/v1/focuser/0/maxstep", HTTP_GET, constant(10000));
+  server.on("/api/v1/focuser/0/maxstep", HTTP_GET, constant(MAXSTEP));
   server.on("/api/v1/focuser/0/position", HTTP_GET, producer([]() { return stepper.currentPosition(); }));
   server.on("/api/v1/focuser/0/stepsize", HTTP_GET, constant(100));
+#ifdef ONE_WIRE_BUS
+  server.on("/api/v1/focuser/0/tempcomp", HTTP_GET, producer([]() { return (bool)tempCompOn; }));
+  server.on("/api/v1/focuser/0/tempcomp", HTTP_PUT, consumer([](AsyncWebServerRequest *request) {
+              tempCompOn = request->getParam("TempComp", true)->value().equalsIgnoreCase("true");
+              Serial.print("Set tempcomp ");
+              Serial.println(tempCompOn);
+            }));
+  server.on("/api/v1/focuser/0/tempcompavailable", HTTP_GET, constant(true));
+  server.on("/api/v1/focuser/0/temperature", HTTP_GET, producer([]() { return sensorTemp / 128.0; }));
+#else
   server.on("/api/v1/focuser/0/tempcomp", HTTP_GET, constant(false));
-  server.on("/api/v1/focuser/0/tempcomp", HTTP_PUT, constant(false));
+  server.on("/api/v1/focuser/0/tempcomp", HTTP_PUT, alpacaResponse([](AsyncWebServerRequest *request, DynamicJsonDocument &doc) {
+              // Turning it off is fine, there is nothing to turn on
+              if (request->getParam("TempComp", true)->value().equalsIgnoreCase("true"))
+              {
+                doc["ErrorNumber"] = 0x400;
+                doc["ErrorMessage"] = "No temperature sensor";
+              }
+            }));
   server.on("/api/v1/focuser/0/tempcompavailable", HTTP_GET, constant(false));
   server.on("/api/v1/focuser/0/temperature", HTTP_GET, constant(-42));
+#endif
 
   server.on("/api/v1/focuser/0/halt", HTTP_PUT, consumer([](AsyncWebServerRequest *request) {
-              stepper.moveTo(stepper.currentPosition());
-              stepper.setMaxSpeed(1);
-              stepper.disableOutputs();
-              Serial.println("Halted");
+              postMotion(REQUEST_HALT);
             }));
 
+  //Move to Position. Beyond the Alpaca API, Relative=true moves by Position steps from the target instead,
+  //and Jog in place of Position moves without stopping at that many steps a second, out if positive or in
+  //if negative, until Jog=0 or an end of the travel. Both ramp like any other move.
   server.on("/api/v1/focuser/0/move", HTTP_PUT, consumer([](AsyncWebServerRequest *request) {
-              stepper.setMaxSpeed(MAXSPEED);
-              stepper.enableOutputs();
-              stepper.moveTo(request->getParam("Position", true)->value().toInt() * MICROSTEPS);
-              Serial.print("Moving to ");
-              Serial.println(stepper.targetPosition() / MICROSTEPS);
+              if (request->hasParam("Jog", true))
+              {
+                postMotion(REQUEST_JOG, request->getParam("Jog", true)->value().toInt() * MICROSTEPS);
+                return;
+              }
+              postMotion(REQUEST_MOVE, request->getParam("Position", true)->value().toInt() * MICROSTEPS,
+                         request->hasParam("Relative", true) && request->getParam("Relative", true)->value().equalsIgnoreCase("true"));
+            }));
+
+  //Backlash, not part of the Alpaca API. Direction is 1 to finish moves outwards, -1 inwards or 0 to
+  //go straight to the target, Overshoot how far past it a move from the wrong side goes, in steps.
+  server.on("/api/v1/focuser/0/backlash", HTTP_GET, alpacaResponse([](AsyncWebServerRequest *request, DynamicJsonDocument &doc) {
+              JsonObject value = doc.createNestedObject("Value");
+              value["Direction"] = backlashDirection;
+              value["Overshoot"] = backlashOvershoot / MICROSTEPS;
+            }));
+  server.on("/api/v1/focuser/0/backlash", HTTP_PUT, consumer([](AsyncWebServerRequest *request) {
+              // Either can be left out to keep it as it is. Both are saved to NVS.
+              int8_t direction = backlashDirection;
+              long overshoot = backlashOvershoot;
+              if (request->hasParam("Direction", true))
+              {
+                long sign = request->getParam("Direction", true)->value().toInt();
+                direction = sign > 0 ? 1 : sign < 0 ? -1 : 0;
+                preferences.putChar("approach", direction);
+              }
+              if (request->hasParam("Overshoot", true))
+              {
+                overshoot = labs(request->getParam("Overshoot", true)->value().toInt()) * MICROSTEPS;
+                preferences.putUShort("overshoot", overshoot / MICROSTEPS);
+              }
+              postBacklash(direction, overshoot);
+              Serial.print("Set backlash ");
+              Serial.print(direction);
+              Serial.print(" ");
+              Serial.println(overshoot / MICROSTEPS);
             }));
 
+#ifdef INSTRUMENT
+  //Instrumentation, not part of the Alpaca API
+  server.on("/api/v1/focuser/0/instrumentation", HTTP_GET, alpacaResponse([](AsyncWebServerRequest *request, DynamicJsonDocument &doc) {
+              JsonObject value = doc.createNestedObject("Value");
+              value["MaxLoopMicros"] = maxLoop;
+              value["SlowLoops"] = slowLoops;
+              value["MissedSteps"] = missedSteps;
+              JsonArray histogram = value.createNestedArray("LoopHistogram");
+              for (uint8_t i = 0; i < INSTRUMENT; i++)
+              {
+                histogram.add(loopHistogram[i]);
+              }
+            }));
+  server.on("/api/v1/focuser/0/instrumentation", HTTP_PUT, consumer([](AsyncWebServerRequest *request) {
+              instrumentReset = true;
+            }));
+#endif
+
   server.begin();
 }
 
@@ -260,8 +618,12 @@ std::function<void(AsyncWebServerRequest *request)> alpacaResponse(F f)
     f(request, doc);
     doc["ClientTransactionID"] = request->getParam("ClientTransactionID", request->method() == HTTP_PUT)->value().toInt();
     doc["ServerTransactionID"] = ++serverTransactionID;
-    doc["ErrorNumber"] = 0;
-    doc["ErrorMessage"] = "";
+    // f sets them itself to report an error
+    if (!doc.containsKey("ErrorNumber"))
+    {
+      doc["ErrorNumber"] = 0;
+      doc["ErrorMessage"] = "";
+    }
     serializeJson(doc, *response);
     request->send(response);
   };
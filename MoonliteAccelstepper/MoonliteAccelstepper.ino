@@ -10,8 +10,17 @@
 // orly.andico@gmail.com, 13 April 2014
 
 #include "src/AccelStepper/AccelStepper.h"
+#include "src/AccelStepper/DriverStepper.h"
 #include "src/OneWire/OneWire.h" 
-#include "src/DallasTemperature/DallasTemperature.h"
+#include "src/StepTimer/StepTimer.h"
+#include "src/MoonliteHex/MoonliteHex.h"
+#include "src/MoonliteBinary/MoonliteBinary.h"
+#include "src/TemperatureSampler/TemperatureSampler.h"
+#include "src/RomTable/RomTable.h"
+#include "src/TempComp/TempComp.h"
+#include "src/Backlash/Backlash.h"
+#include "src/PositionJournal/PositionJournal.h"
+#include <EEPROM.h>
 
 /* Microstepping Settings.
  * Run full 16x microstepping all the time on hardware for smoothing and reducing resonance.
@@ -35,6 +44,21 @@
 #define SECONDS_PER_REV 3
 #define MAXSPEED (STEPS_PER_REV / SECONDS_PER_REV)
 #define ACCELERATION 500
+/* Optional table of precomputed step intervals for the start of each ramp, 2 bytes RAM per entry */
+//#define RAMP_TABLE_SIZE 64
+/* Optional queue of SN positions, 4 bytes RAM per entry. A SN while the motor is still moving is
+ * queued behind the current target instead of replacing it, so a series of moves in the same
+ * direction (eg an autofocus sweep) runs through without stopping in between.
+ */
+//#define MOVE_QUEUE 8
+/* Optional timing instrumentation, 4 bytes RAM per bucket. Keeps log2 histograms of how late each
+ * step is taken and of the time between passes through loop(), where bucket 0 counts times under
+ * 1us, bucket n those from 2^(n-1) up to 2^n us and the last bucket everything longer. Counts are
+ * halved when one would overflow, so only their proportions are meaningful over long runs.
+ * :XI# dumps them, :XZ# clears them. With STEP_TIMER a step's lateness is how long its interrupt
+ * took to be entered.
+ */
+//#define INSTRUMENT 16
 
 /*How long wait after motion is stopped to disable stepper */
 #define SETTLE_MS 500
@@ -51,33 +75,144 @@
 #define MS1 8
 #define SLEEP_PIN 4
 
+/* Generate step pulses from a Timer2 interrupt rather than polling in loop().
+ * Serial and temperature handling then no longer delay steps. Timer2 is
+ * also used for PWM on pins 3 and 11, which must only be used as digital pins.
+ */
+//#define STEP_TIMER
+
+/* Baud rate of the Moonlite ASCII protocol */
+#define BAUD 9600
+
+/* Optional binary protocol for polling fast, see src/MoonliteBinary/MoonliteBinary.h for the packets.
+ * :XFxxxxx# answers 01# then switches to the baud rate given in hex, or BINARY_BAUD if there is none,
+ * and from then on takes binary requests, each answered with the status. The EXIT request, or
+ * BINARY_TIMEOUT_MS without a good request, goes back to ASCII at BAUD.
+ */
+#define BINARY_PROTOCOL
+#define BINARY_BAUD 115200
+#define BINARY_TIMEOUT_MS 5000
+
+/* Optional position streaming. After :XUxxxx# the position is sent every xxxx (hex) milliseconds
+ * while the motor moves, as *PPPP,01#, and once more as *PPPP,00# when it arrives, so a client
+ * need not poll. No response starts with *, so these can be told apart from the replies to
+ * commands, and they are only sent between commands, never in the middle of a reply.
+ * :XU0000# stops them. Intervals below STREAM_MIN_MS are raised to it, to leave the link free.
+ */
+#define POSITION_STREAM
+#define STREAM_MIN_MS 20
+
 /* Optional feature pins */
 #define ONE_WIRE_BUS 11
 #define LED_PIN 10
 
-AccelStepper stepper(1, STEP_PIN, DIR_PIN);
+/* Read just the two temperature bytes from the sensor, checking they are plausible,
+ * with a full read checked by CRC every this many readings. Comment out to always do full reads.
+ */
+#define TEMP_FULL_READ_EVERY 10
+
+/* Where in EEPROM the temperature sensors' ROM codes are kept between boots, RomTable::size() bytes.
+ * They are checked at boot and the bus is only searched again when one of them does not answer.
+ * :XR# forgets them, so the next boot searches the bus whatever happens.
+ */
+#define EEPROM_ROM_TABLE 0
+
+/* Temperature compensation, turned on with :+# and off with :-#. While it is on and the motor is
+ * otherwise idle, the focuser moves TEMP_COEFFICIENT steps out for every degree C the temperature
+ * rises from when it was turned on or last sent somewhere with :FG#, whenever that comes to at
+ * least TEMP_COMP_DEADBAND steps. :SCxx# changes the coefficient, a signed two digit hex number.
+ */
+#define TEMP_COEFFICIENT 2
+#define TEMP_COMP_DEADBAND 1
+
+/* Backlash compensation: moves finish in BACKLASH_DIRECTION, 1 for outwards, -1 inwards or 0 to go
+ * straight to the target. A move that would finish the other way overshoots the target by BACKLASH_STEPS
+ * and comes back. These are the defaults for the settings kept in EEPROM, changed by :XAxx# and :XBxxxx#.
+ */
+#define BACKLASH_DIRECTION 0
+#define BACKLASH_STEPS 10
+/* Where in EEPROM the settings are kept, just after the ROM table */
+#define EEPROM_SETTINGS (EEPROM_ROM_TABLE + RomTable::size())
+
+/* Optional journal of the motor position in EEPROM, so a reset (eg from DTR, see above) does not lose it.
+ * The position is saved each time the motor settles, to the next of this many slots of 7 bytes in turn,
+ * which spreads the wear: each slot is good for about 100000 saves. Comment out to start at 0 every reset.
+ */
+#define JOURNAL_SLOTS 64
+#define EEPROM_JOURNAL (EEPROM_SETTINGS + sizeof(Settings))
+
+//Direction is inverted, step is not. Must match setPinsInverted() in setup()
+DriverStepper<STEP_PIN, DIR_PIN, true, false> stepper;
+#ifdef RAMP_TABLE_SIZE
+uint16_t rampTable[RAMP_TABLE_SIZE];
+#endif
+#ifdef MOVE_QUEUE
+long moveQueue[MOVE_QUEUE];
+#endif
+#ifdef INSTRUMENT
+uint16_t stepHistogram[INSTRUMENT];
+uint16_t loopHistogram[INSTRUMENT];
+unsigned long maxLoop = 0;
+unsigned long lastLoop = 0;
+#endif
+
+//Everything after setup() goes through motor, so the ISR sees consistent state,
+//and moves go through backlash so they finish from the configured side
+#ifdef STEP_TIMER
+StepTimer motor(stepper);
+Backlash<StepTimer> backlash(motor);
+#else
+AccelStepper &motor = stepper;
+Backlash<AccelStepper> backlash(motor);
+#endif
 
 #ifdef ONE_WIRE_BUS
 OneWire oneWire(ONE_WIRE_BUS); 
-DallasTemperature sensors(&oneWire);
-DeviceAddress thermometer;
+RomTable romTable(EEPROM_ROM_TABLE);
+TemperatureSampler temperature(oneWire);
+TempComp tempComp(TEMP_COEFFICIENT, TEMP_COMP_DEADBAND);
 #endif
 
 
 //Input Handling
-#define MAXCOMMAND 8
-char inChar;
-char cmd[MAXCOMMAND];
-char param[MAXCOMMAND];
-char line[MAXCOMMAND];
-int eoc = 0;
-int idx = 0;
+/* Longest command between : and #. Longer ones are dropped whole rather than run cut short */
+#define MAXCOMMAND 16
+/* Complete commands held until loop() gets to them. While it is full, input waits in the serial buffer */
+#define COMMAND_QUEUE 4
+/* How long one pass of loop() may spend running queued commands, in microseconds */
+#define COMMAND_BUDGET_US 2000
+char line[MAXCOMMAND + 1];
+int idx = 0;  // -1 while skipping the rest of an overlong command
+char commands[COMMAND_QUEUE][MAXCOMMAND + 1];
+uint8_t commandHead = 0;
+uint8_t commandCount = 0;
+#ifdef BINARY_PROTOCOL
+boolean binaryMode = false;
+unsigned long binaryLastRequest = 0;
+MoonliteReceiver receiver;
+#endif
+#ifdef POSITION_STREAM
+uint16_t streamInterval = 0;  // 0 while streaming is off
+unsigned long streamLast = 0;
+boolean streamMoving = false;
+#endif
 
 //Internal State
 int lastTemp = 0;
-long millisLastTemp = 0;
+int tempOffset = 0;  // added to lastTemp for GT, set by PO
 long millisLastMove = 0;
 
+//Settings kept in EEPROM, behind a CRC
+struct Settings {
+  int8_t backlashDirection;
+  uint16_t backlashSteps;
+  uint8_t crc;
+} settings;
+
+#ifdef JOURNAL_SLOTS
+PositionJournal journal(EEPROM_JOURNAL, JOURNAL_SLOTS);
+#endif
+
 //Moonlite State
 long pos;
 int speed = 2;
@@ -86,15 +221,35 @@ int light = 255;
 
 void setup()
 {  
-  Serial.begin(9600);
+  Serial.begin(BAUD);
   
+#ifdef RAMP_TABLE_SIZE
+  stepper.setRampTable(rampTable, RAMP_TABLE_SIZE);
+#endif
+#ifdef MOVE_QUEUE
+  stepper.setQueue(moveQueue, MOVE_QUEUE);
+#endif
+#ifdef INSTRUMENT
+  stepper.setLatenessHistogram(stepHistogram, INSTRUMENT);
+#endif
   stepper.setMaxSpeed(MAXSPEED);
   stepper.setAcceleration(ACCELERATION);
   stepper.disableOutputs();
   stepper.setEnablePin(ENABLE_PIN);
   stepper.setPinsInverted(true,false,true);
-  memset(line, 0, MAXCOMMAND);
+  stepper.setScheduledStepping(true);
   millisLastMove = millis();
+  loadSettings();
+#ifdef JOURNAL_SLOTS
+  //Carry on from where the motor was before the reset
+  if (journal.load()) {
+    stepper.setCurrentPosition(journal.position());
+  }
+#endif
+
+#ifdef STEP_TIMER
+  motor.begin();
+#endif
 
 #ifdef LED_PIN
   analogWrite(LED_PIN, light);
@@ -123,18 +278,57 @@ void setup()
 #endif
 
 #ifdef ONE_WIRE_BUS
-  //Start up sensors
-  sensors.begin();
-  sensors.getAddress(thermometer, 0);
-  sensors.requestTemperaturesByAddress(thermometer);
-  lastTemp = sensors.getTempC(thermometer)*2;
-  sensors.setWaitForConversion(false);
+  //Use the sensors found on an earlier boot if they all still answer, otherwise search for them
+  if (!romTable.load() || !romTable.verify(oneWire)) {
+    romTable.search(oneWire);
+    romTable.save();
+  }
+  //Read all of them in the background, GT reports the first once its first reading is in
+  for (uint8_t i = 0; i < romTable.count(); i++) {
+    temperature.addSensor(romTable.rom(i));
+  }
+  temperature.setSkipRom(romTable.count() == 1);
+#ifdef TEMP_FULL_READ_EVERY
+  temperature.setTruncatedReads(TEMP_FULL_READ_EVERY);
+#endif
+  temperature.begin(romTable.parasite());
 #endif
+
+#ifdef INSTRUMENT
+  lastLoop = micros();
+#endif
+}
+
+// The 1-Wire CRC, inverted so that erased EEPROM does not pass
+uint8_t settingsCrc() {
+  return ~OneWire::crc8((const uint8_t*)&settings, offsetof(Settings, crc));
+}
+
+// Reads the settings from EEPROM, falling back to the defaults if they were never saved
+void loadSettings() {
+  EEPROM.get(EEPROM_SETTINGS, settings);
+  if (settings.crc != settingsCrc()) {
+    settings.backlashDirection = BACKLASH_DIRECTION;
+    settings.backlashSteps = BACKLASH_STEPS;
+  }
+  applySettings();
+}
+
+// Writes the settings to EEPROM, only touching the bytes that changed
+void saveSettings() {
+  settings.crc = settingsCrc();
+  EEPROM.put(EEPROM_SETTINGS, settings);
+}
+
+// Puts the settings into effect. The backlash is in Moonlite steps, so it changes with half_step.
+void applySettings() {
+  backlash.setDirection(settings.backlashDirection);
+  backlash.setOvershoot((long)settings.backlashSteps * MICROSTEP_MULTIPLIER);
 }
 
 void motion(){
   //Motion Controll
-  if (stepper.run()) {
+  if (backlash.run()) {
     millisLastMove = millis();
   } 
   else {
@@ -142,203 +336,671 @@ void motion(){
     // over a short interval; hence we only disable the outputs and release the motor some seconds
     // after movement has stopped
     if ((millis() - millisLastMove) > SETTLE_MS) {
-       stepper.disableOutputs();
+       motor.disableOutputs();
+#ifdef JOURNAL_SLOTS
+       // only writes anything when the position has changed since it was last saved
+       journal.save(motor.currentPosition());
+#endif
     }
   }
 }
 
-void loop(){
-  motion();
+#ifdef INSTRUMENT
+void instrumentLoop(){
+  unsigned long now = micros();
+  unsigned long took = now - lastLoop;
+  lastLoop = now;
+  if (took > maxLoop) {
+    maxLoop = took;
+  }
+  uint8_t bucket = 0;
+  for (unsigned long t = took; t && bucket < INSTRUMENT - 1; t >>= 1) {
+    bucket++;
+  }
+  if (loopHistogram[bucket] == 0xffff) {
+    for (uint8_t i = 0; i < INSTRUMENT; i++) {
+      loopHistogram[i] >>= 1;
+    }
+  }
+  loopHistogram[bucket]++;
+}
+#endif
+
+#ifdef POSITION_STREAM
+// *PPPP,II#
+#define STREAM_FRAME 9
+
+// Sends the position and whether it is still moving
+void streamPosition(boolean moving){
+  char frame[STREAM_FRAME];
+  char *end = frame;
+  *end++ = '*';
+  end = hexEncode(end, motor.currentPosition() / MICROSTEP_MULTIPLIER, 4);
+  *end++ = ',';
+  end = hexEncode(end, moving ? 1 : 0, 2);
+  *end++ = '#';
+  Serial.write(frame, end - frame);
+}
 
-  //Read One Character from serial
-  if (Serial.available()) {
-    inChar = Serial.read();
-    if (inChar != '#' && inChar != ':') {
-      line[idx++] = inChar;
-      if (idx >= MAXCOMMAND) {
-        idx = MAXCOMMAND - 1;
+// Streams the position while moving, and the arrival once it stops
+void stream(){
+  if (!streamInterval) {
+    return;
+  }
+  boolean moving = backlash.isRunning();
+  if (moving) {
+    // the first straight away, then every interval. One that would have to wait for room
+    // in the transmit buffer is skipped rather than hold up the motor.
+    unsigned long now = millis();
+    if ((!streamMoving || now - streamLast >= streamInterval) && Serial.availableForWrite() >= STREAM_FRAME) {
+      streamPosition(true);
+      streamLast = now;
+    }
+  }
+  else if (streamMoving) {
+    streamPosition(false);
+  }
+  streamMoving = moving;
+}
+#endif
+
+// Moves everything the serial port has received into line, queueing each command as its # arrives
+void readSerial(){
+  while (commandCount < COMMAND_QUEUE && Serial.available()) {
+    char inChar = Serial.read();
+    if (inChar == ':') {
+      idx = 0;
+    }
+    else if (inChar == '#') {
+      if (idx >= 0) {
+        // strncpy zero fills the rest, so the parameter after the two letter opcode is always there, if empty
+        line[idx] = 0;
+        strncpy(commands[(commandHead + commandCount) % COMMAND_QUEUE], line, MAXCOMMAND + 1);
+        commandCount++;
+      }
+      idx = 0;
+    }
+    else if (idx >= 0) {
+      if (idx < MAXCOMMAND) {
+        line[idx++] = inChar;
       }
-    } 
-    else {
-      if (inChar == '#') {
-        eoc = 1;
+      else {
+        idx = -1;
       }
     }
-    motion();
-  } // end if (!Serial.available())
+  }
+}
 
-  // process the command we got
-  if (eoc) {
-    memset(cmd, 0, MAXCOMMAND);
-    memset(param, 0, MAXCOMMAND);
+void loop(){
+#ifdef INSTRUMENT
+  instrumentLoop();
+#endif
+  motion();
+
+#ifdef ONE_WIRE_BUS
+  // a time slot of the temperature readout. Held off while moving, with the timer stepping too:
+  // a slot masks interrupts for up to 70us, which would delay a step, and a step interrupt in the
+  // low half of writing a 0 could stretch it past the 120us a slot allows. The first batch is never
+  // held off, so GT has a reading within a conversion of boot even if a move starts straight away
+  boolean holdOff = motor.distanceToGo() != 0 && temperature.valid();
+  if (temperature.run(holdOff) && temperature.valid()) {
+    lastTemp = temperature.temperature() / 64;
+    tempComp.addSample(temperature.temperature());
+  }
 
-    int len = strlen(line);
-    if (len >= 2) {
-      strncpy(cmd, line, 2);
+  // keep in focus as the temperature changes, but only while nothing else wants the motor
+  if (!commandCount && !motor.isRunning() && !backlash.isRunning()) {
+    long steps = tempComp.correction();
+    if (steps) {
+      tempComp.applied(steps);
+      motor.setMaxSpeed(MAXSPEED * 2L / speed);
+      motor.enableOutputs();
+      backlash.moveTo(motor.currentPosition() + steps * MICROSTEP_MULTIPLIER);
     }
+  }
+#endif
+
+#ifdef BINARY_PROTOCOL
+  if (binaryMode) {
+    readBinary();
+    return;
+  }
+#endif
 
-    if (len > 2) {
-      strncpy(param, line + 2, len - 2);
+  // run what has arrived, a batch like :GP#:GI#:GT# in one pass, but keep the motor going in between
+  readSerial();
+  unsigned long started = micros();
+  while (commandCount) {
+    char *command = commands[commandHead];
+    dispatch(command, command + 2);
+    commandHead = (commandHead + 1) % COMMAND_QUEUE;
+    commandCount--;
+#ifdef BINARY_PROTOCOL
+    // the rest is meant for the binary protocol, or noise
+    if (binaryMode) {
+      commandCount = 0;
+      break;
+    }
+#endif
+    motion();
+    if (micros() - started > COMMAND_BUDGET_US) {
+      break;
     }
+    readSerial();
+  }
 
-    memset(line, 0, MAXCOMMAND);
-    eoc = 0;
-    idx = 0;
+#ifdef POSITION_STREAM
+  stream();
+#endif
+} // end loop
 
-    // the stand-alone program sends :C# :GB# on startup
-    // :C# is a temperature conversion, doesn't require any response
+// Sends value as a fixed width hex response, in one write
+void reply(unsigned long value, uint8_t digits) {
+  char response[HEX_MAX_DIGITS + 1];
+  Serial.write(response, hexResponse(response, value, digits));
+}
 
-    // LED backlight value, always return "00"
-    if (!strcasecmp(cmd, "GB")) {
-      Serial.print("00#");
-    }
+// The target the motor will end up at
+long targetPosition() {
+#ifdef MOVE_QUEUE
+  return motor.queueLength() ? motor.queueEndPosition() : backlash.targetPosition();
+#else
+  return backlash.targetPosition();
+#endif
+}
 
+// Sets where to move to, in Moonlite steps
+void setTarget(long target) {
+#ifdef MOVE_QUEUE
+  // Keep moving until there is room, rather than lose the position
+  while (!backlash.queueMoveTo(target * MICROSTEP_MULTIPLIER)) {
+    motion();
+  }
+#else
+  backlash.moveTo(target * MICROSTEP_MULTIPLIER);
+#endif
+}
+
+// Starts moving to the target
+void startMove() {
+  motor.setMaxSpeed(MAXSPEED * 2L / speed);
+  motor.enableOutputs();
+#ifdef ONE_WIRE_BUS
+  // compensate from the new focus position
+  tempComp.reference();
+#endif
+#ifdef POSITION_STREAM
+  // so there is an arrival even for a move that goes nowhere
+  streamMoving = true;
+#endif
+  delay(1);
+}
+
+// Stops where the motor is
+void stopMove() {
+#ifdef MOVE_QUEUE
+  motor.clearQueue();
+#endif
+  backlash.cancel();
+  motor.moveTo(motor.currentPosition());
+  motor.setMaxSpeed(1);
+  motor.disableOutputs();
+}
+
+// Moves without stopping towards an end of the Moonlite range, out if jogSpeed is positive or in if negative,
+// ramping up to the speed SD would give for its size. 0 ramps down to a stop.
+void jog(int8_t jogSpeed) {
+#ifdef MOVE_QUEUE
+  motor.clearQueue();
+#endif
+  if (!jogSpeed) {
+    // on a whole Moonlite step, so GP and SN still agree
+    backlash.stop(MICROSTEP_MULTIPLIER);
+    return;
+  }
+  long position = motor.currentPosition();
+  // ramps down first if the new speed is slower, so changing speed or direction part way is smooth too
+  backlash.jog(jogSpeed > 0 ? max(position, 0xFFFFL * MICROSTEP_MULTIPLIER) : min(position, 0L),
+               MAXSPEED * 2L / max(abs(jogSpeed), 2));
+  motor.enableOutputs();
+#ifdef ONE_WIRE_BUS
+  tempComp.reference();
+#endif
+}
+
+// Sets the speed, only acceptable values are 02, 04, 08, 10, 20
+void setSpeed(int newSpeed) {
+  speed = newSpeed;
+  //Setting the speed too close to the end causes accelstepper to
+  //overshoot when moving positive, and freak out when moving negative
+  if ( abs(motor.distanceToGo()) > 20 ){
+    motor.setMaxSpeed(MAXSPEED * 2L / speed);
+  }
+}
+
+// Moonlite opcodes are two letters, packed into one switch key
+#define OP(a, b) ((uint16_t)(a) << 8 | (b))
+
+// Runs one command. Unknown commands are ignored.
+// The stand-alone program sends :C# :GB# on startup,
+// :C# is a temperature conversion, doesn't require any response
+void dispatch(const char *cmd, char *param) {
+  switch (OP(toupper(cmd[0]), toupper(cmd[1]))) {
     // home the motor, hard-coded, ignore parameters since we only have one motor
-    if (!strcasecmp(cmd, "PH")) { 
-      stepper.setCurrentPosition(100);
-      stepper.moveTo(0);
+    case OP('P', 'H'): {
+      backlash.setCurrentPosition(100);
+      backlash.moveTo(0);
+      break;
     }
 
     // firmware value, always return "10"
-    if (!strcasecmp(cmd, "GV")) {
+    case OP('G', 'V'): {
       Serial.print("10#");
+      break;
     }
 
     // get the current motor position
-    if (!strcasecmp(cmd, "GP")) {
-      pos = stepper.currentPosition() / MICROSTEP_MULTIPLIER;
-      char tempString[6];
-      sprintf(tempString, "%04X", pos);
-      Serial.print(tempString);
-      Serial.print("#");
+    case OP('G', 'P'): {
+      pos = motor.currentPosition() / MICROSTEP_MULTIPLIER;
+      reply(pos, 4);
+      break;
     }
 
     // get the new motor position (target)
-    if (!strcasecmp(cmd, "GN")) {
-      pos = stepper.targetPosition() / MICROSTEP_MULTIPLIER;
-      char tempString[6];
-      sprintf(tempString, "%04X", pos);
-      Serial.print(tempString);
-      Serial.print("#");
+    case OP('G', 'N'): {
+      pos = targetPosition() / MICROSTEP_MULTIPLIER;
+      reply(pos, 4);
+      break;
     }
 
     // get the current temperature
-    // The temperature is sent in .5 *C units
-    if (!strcasecmp(cmd, "GT")) {
+    // The temperature is sent in .5 *C units, the last reading taken in the background
+    case OP('G', 'T'): {
+      reply(lastTemp + tempOffset, 4);
+      break;
+    }
+
+    // get everything a status poll wants in one response: GP, GN, GI, GT and GD comma separated,
+    // as PPPP,NNNN,II,TTTT,DD#. All taken in this one pass, so they agree with each other.
+    case OP('X', 'S'): {
+      // moving first, so a move finishing part way through shows as still moving at the target,
+      // never as stopped short of it
+      boolean moving = backlash.isRunning();
+      char status[4 + 1 + 4 + 1 + 2 + 1 + 4 + 1 + 2 + 1];
+      char *end = status;
+      end = hexEncode(end, motor.currentPosition() / MICROSTEP_MULTIPLIER, 4);
+      *end++ = ',';
+      end = hexEncode(end, targetPosition() / MICROSTEP_MULTIPLIER, 4);
+      *end++ = ',';
+      end = hexEncode(end, moving ? 1 : 0, 2);
+      *end++ = ',';
+      end = hexEncode(end, lastTemp + tempOffset, 4);
+      *end++ = ',';
+      end = hexEncode(end, speed, 2);
+      *end++ = '#';
+      Serial.write(status, end - status);
+      break;
+    }
+
+    // set the temperature calibration offset, a signed two digit hex number of .5 *C added to GT
+    case OP('P', 'O'): {
+      tempOffset = (int8_t)hexDecode(param);
+      break;
+    }
+
+    // get every temperature sensor, comma separated. Each is the temperature in .5 *C units as for GT,
+    // then two digits of the age of the reading in seconds, FF if older or never read
+    case OP('X', 'T'): {
 #ifdef ONE_WIRE_BUS
-    if ((millis() - millisLastTemp) > 1000 && !stepper.distanceToGo() ) {
-      lastTemp = sensors.getTempC(thermometer)*2;
-      motion();
-      sensors.requestTemperaturesByAddress(thermometer);
-      millisLastTemp = millis();
+      unsigned long now = millis();
+      for (uint8_t i = 0; i < temperature.sensors(); i++) {
+        char field[7];
+        char *end = field;
+        if (i) {
+          *end++ = ',';
+        }
+        unsigned long age = temperature.valid(i) ? (now - temperature.time(i)) / 1000 : 0xff;
+        end = hexEncode(end, temperature.temperature(i) / 64, 4);
+        end = hexEncode(end, age < 0xff ? age : 0xff, 2);
+        Serial.write(field, end - field);
+      }
+#endif
+      Serial.print('#');
+      break;
+    }
+
+    // get or set the direction moves finish in, a signed two digit hex number: 01 outwards,
+    // FF inwards or 00 straight to the target. Setting it saves it to EEPROM.
+    case OP('X', 'A'): {
+      if (*param) {
+        settings.backlashDirection = (int8_t)hexDecode(param);
+        applySettings();
+        saveSettings();
+      }
+      else {
+        reply((uint8_t)backlash.direction(), 2);
+      }
+      break;
+    }
+
+    // get or set how far past the target a move from the wrong side goes, four hex digits of steps.
+    // Setting it saves it to EEPROM.
+    case OP('X', 'B'): {
+      if (*param) {
+        settings.backlashSteps = hexDecode(param);
+        applySettings();
+        saveSettings();
+      }
+      else {
+        reply(settings.backlashSteps, 4);
+      }
+      break;
+    }
+
+#ifdef POSITION_STREAM
+    // get or set the interval the position is streamed at while moving, four hex digits of
+    // milliseconds, 0000 for off. It starts off.
+    case OP('X', 'U'): {
+      if (*param) {
+        streamInterval = hexDecode(param);
+        if (streamInterval && streamInterval < STREAM_MIN_MS) {
+          streamInterval = STREAM_MIN_MS;
+        }
+        streamMoving = false;
+      }
+      else {
+        reply(streamInterval, 4);
+      }
+      break;
     }
 #endif
-      char tempString[6];
-      sprintf(tempString, "%04X", lastTemp);
-      Serial.print(tempString);
-      Serial.print("#");
+
+#ifdef BINARY_PROTOCOL
+    // switch to the binary protocol, at the baud rate given in hex or BINARY_BAUD
+    case OP('X', 'F'): {
+      unsigned long baud = *param ? hexDecode(param) : BINARY_BAUD;
+      if (baud < 1200) {
+        Serial.print("00#");
+        break;
+      }
+      Serial.print("01#");
+      Serial.flush();
+      Serial.begin(baud);
+      receiver.reset();
+      binaryMode = true;
+      binaryLastRequest = millis();
+      break;
     }
+#endif
 
-    // get the temperature coefficient, hard-coded
-    if (!strcasecmp(cmd, "GC")) {
-      Serial.print("02#");
+    // forget the temperature sensors' ROM codes, the bus is searched again on the next boot
+    case OP('X', 'R'): {
+#ifdef ONE_WIRE_BUS
+      romTable.invalidate();
+#endif
+      break;
     }
 
+    // get the temperature coefficient, steps per degree C as a signed two digit hex number
+    case OP('G', 'C'): {
+#ifdef ONE_WIRE_BUS
+      reply((uint8_t)tempComp.coefficient(), 2);
+#else
+      reply(TEMP_COEFFICIENT, 2);
+#endif
+      break;
+    }
+
+#ifdef ONE_WIRE_BUS
+    // set the temperature coefficient
+    case OP('S', 'C'): {
+      tempComp.setCoefficient((int8_t)hexDecode(param));
+      break;
+    }
+
+    // turn temperature compensation on, from the current position and temperature
+    case OP('+', 0): {
+      tempComp.setEnabled(true);
+      break;
+    }
+
+    // turn temperature compensation off
+    case OP('-', 0): {
+      tempComp.setEnabled(false);
+      break;
+    }
+#endif
+
     // get the current light
-    if (!strcasecmp(cmd, "GB")) {
-      char tempString[6];
-      sprintf(tempString, "%02X", light);
-      Serial.print(tempString);
-      Serial.print("#");
+    case OP('G', 'B'): {
+      reply(light, 2);
+      break;
     }
 
     //set the light
-    if (!strcasecmp(cmd, "SB")) {
-      light = hexstr2long(param);
+    case OP('S', 'B'): {
+      light = hexDecode(param);
 #ifdef LED_PIN
       analogWrite(LED_PIN, light);
 #endif
+      break;
     }
     
     // get the current motor speed, only values of 02, 04, 08, 10, 20
-    if (!strcasecmp(cmd, "GD")) {
-      char tempString[6];
-      sprintf(tempString, "%02X", speed);
-      Serial.print(tempString);
-      Serial.print("#");
+    case OP('G', 'D'): {
+      reply(speed, 2);
+      break;
     }
 
     // set speed, only acceptable values are 02, 04, 08, 10, 20
-    if (!strcasecmp(cmd, "SD")) {
-      speed = hexstr2long(param);
-      //Setting the speed too close to the end causes accelstepper to
-      //overshoot when moving positive, and freak out when moving negative
-      if ( abs(stepper.distanceToGo()) > 20 ){
-        stepper.setMaxSpeed(MAXSPEED * 2L / speed);
-      }
+    case OP('S', 'D'): {
+      setSpeed(hexDecode(param));
+      break;
     }
 
     /* Get half-stepping */
-    if (!strcasecmp(cmd, "GH")) {
+    case OP('G', 'H'): {
       if (half_step) {
         Serial.print("FF#");
       } else {
         Serial.print("00#");
       }
+      break;
     }
 
     // motor is moving - 01 if moving, 00 otherwise
-    if (!strcasecmp(cmd, "GI")) {
-      if (abs(stepper.distanceToGo()) > 0) {
+    case OP('G', 'I'): {
+      if (backlash.isRunning()) {
         Serial.print("01#");
       } 
       else {
         Serial.print("00#");
       }
+      break;
     }
 
     // set current motor position
-    if (!strcasecmp(cmd, "SP")) {
-      pos = hexstr2long(param);
-      stepper.setCurrentPosition(pos * MICROSTEP_MULTIPLIER);
+    case OP('S', 'P'): {
+      pos = hexDecode(param);
+      backlash.setCurrentPosition(pos * MICROSTEP_MULTIPLIER);
+      break;
     }
 
     // set new motor position
-    if (!strcasecmp(cmd, "SN")) {
-      pos = hexstr2long(param);
-      stepper.moveTo(pos * MICROSTEP_MULTIPLIER);
+    case OP('S', 'N'): {
+      pos = hexDecode(param);
+      setTarget(pos);
+      break;
     }
 
     /* Set half-step mode */
-    if (!strcasecmp(cmd, "SH")) {
+    case OP('S', 'H'): {
         half_step = 1;
+        applySettings();
+        break;
     }
 
     /* Set full-step mode */
-    if (!strcasecmp(cmd, "SF")) {
+    case OP('S', 'F'): {
         half_step = 0;
+        applySettings();
+        break;
     }
 
     //Actually start the move
-    if (!strcasecmp(cmd, "FG")) {
-      stepper.setMaxSpeed(MAXSPEED * 2L / speed);
-      stepper.enableOutputs();
-      delay(1);
+    case OP('F', 'G'): {
+      startMove();
+      break;
     }
 
     // stop a move
-    if (!strcasecmp(cmd, "FQ")) {
-      stepper.moveTo(stepper.currentPosition());
-      stepper.setMaxSpeed(1);
-      stepper.disableOutputs();
+    case OP('F', 'Q'): {
+      stopMove();
+      break;
+    }
+
+    // move by a signed four digit hex number of steps from the target, starting straight away
+    case OP('X', 'M'): {
+      setTarget(targetPosition() / MICROSTEP_MULTIPLIER + (int16_t)hexDecode(param));
+      startMove();
+      break;
+    }
+
+    // jog at a signed two digit hex speed, in the units of SD, out if positive and in if negative,
+    // until :XJ00# or an end of the range. Takes effect on this pass of loop(), with the usual ramp.
+    case OP('X', 'J'): {
+      jog((int8_t)hexDecode(param));
+      break;
+    }
+
+#ifdef INSTRUMENT
+    // dump the instrumentation as comma separated hex: longest loop (us), late steps, missed steps,
+    // worst step lateness (us), then the step lateness and the loop time histograms.
+    // Sending it stalls loop() for a while, so that pass is left out of the loop times.
+    case OP('X', 'I'): {
+      Serial.print(maxLoop, HEX);
+      Serial.print(',');
+      Serial.print(stepper.lateSteps(), HEX);
+      Serial.print(',');
+      Serial.print(stepper.missedSteps(), HEX);
+      Serial.print(',');
+      Serial.print(stepper.maxLateness(), HEX);
+      for (uint8_t i = 0; i < INSTRUMENT; i++) {
+        Serial.print(',');
+        Serial.print(stepHistogram[i], HEX);
+      }
+      for (uint8_t i = 0; i < INSTRUMENT; i++) {
+        Serial.print(',');
+        Serial.print(loopHistogram[i], HEX);
+      }
+      Serial.print('#');
+      lastLoop = micros();
+      break;
     }
 
+    // clear the instrumentation
+    case OP('X', 'Z'): {
+      stepper.resetStepStats();
+      memset(loopHistogram, 0, sizeof(loopHistogram));
+      maxLoop = 0;
+      lastLoop = micros();
+      break;
+    }
+#endif
   }
-} // end loop
+}
+
+#ifdef BINARY_PROTOCOL
+// Runs the binary requests that have arrived, each answered with the status,
+// and goes back to ASCII if they stop coming
+void readBinary() {
+  while (binaryMode && Serial.available()) {
+    if (receiver.add(Serial.read())) {
+      binaryLastRequest = millis();
+      dispatchBinary(receiver.request());
+      motion();
+    }
+  }
+  if (binaryMode && millis() - binaryLastRequest > BINARY_TIMEOUT_MS) {
+    endBinary();
+  }
+}
+
+// Back to the ASCII protocol, at its baud rate
+void endBinary() {
+  Serial.flush();
+  Serial.begin(BAUD);
+  binaryMode = false;
+  idx = 0;
+}
+
+// Runs one binary request and sends the status
+void dispatchBinary(const MoonliteRequest &request) {
+  MoonliteStatus status;
+  status.opcode = request.opcode;
+  status.sequence = request.sequence;
+  status.result = MOONLITEBINARY_OK;
+
+  switch (request.opcode) {
+    case MOONLITEBINARY_STATUS:
+    case MOONLITEBINARY_EXIT:
+      break;
+
+    case MOONLITEBINARY_MOVE:
+      pos = request.argument;
+      setTarget(pos);
+      startMove();
+      break;
+
+    case MOONLITEBINARY_HALT:
+      stopMove();
+      break;
+
+    case MOONLITEBINARY_SET_POSITION:
+      pos = request.argument;
+      backlash.setCurrentPosition(pos * MICROSTEP_MULTIPLIER);
+      break;
+
+    case MOONLITEBINARY_SET_SPEED:
+      // only the SD values, 0 would divide by zero and a negative one reverse the max speed
+      if (request.argument >= 2 && request.argument <= 0x20 && (request.argument & (request.argument - 1)) == 0) {
+        setSpeed(request.argument);
+      } else {
+        status.result = MOONLITEBINARY_BAD_ARGUMENT;
+      }
+      break;
 
-long hexstr2long(char *line) {
-  long ret = 0;
+#ifdef ONE_WIRE_BUS
+    case MOONLITEBINARY_TEMP_COMP:
+      tempComp.setEnabled(request.argument != 0);
+      break;
+#endif
+
+    default:
+      status.result = MOONLITEBINARY_UNKNOWN;
+      break;
+  }
+
+  status.flags = (backlash.isRunning() ? MOONLITEBINARY_MOVING : 0) | (half_step ? MOONLITEBINARY_HALF_STEP : 0);
+  status.position = motor.currentPosition() / MICROSTEP_MULTIPLIER;
+  status.target = targetPosition() / MICROSTEP_MULTIPLIER;
+  status.temperature = 0;
+#ifdef ONE_WIRE_BUS
+  if (temperature.valid()) {
+    status.flags |= MOONLITEBINARY_TEMPERATURE;
+    status.temperature = temperature.temperature() + tempOffset * 64;
+  }
+  if (tempComp.enabled()) {
+    status.flags |= MOONLITEBINARY_TEMP_COMP_ON;
+  }
+#endif
 
-  ret = strtol(line, NULL, 16);
-  return (ret);
+  uint8_t frame[MOONLITEBINARY_RESPONSE_SIZE];
+  moonliteEncodeStatus(frame, status);
+  Serial.write(frame, sizeof(frame));
+
+  if (request.opcode == MOONLITEBINARY_EXIT) {
+    endBinary();
+  }
 }
+#endif
@@ -0,0 +1,99 @@
+// Arduino.h
+//
+// Host stand in for the Arduino core, enough to build the Moonlite sketch and its
+// libraries natively. Time is virtual: it only moves on when the firmware delays,
+// calls micros()/millis(), or the simulator charges the cost of a loop().
+// See Sim.h for the simulator side.
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <strings.h>
+#include <stdio.h>
+#include <math.h>
+#include <cstdlib>
+#include <algorithm>
+
+typedef bool boolean;
+typedef uint8_t byte;
+typedef uint16_t word;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define PROGMEM
+#define F(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+using std::min;
+using std::max;
+
+unsigned long micros();
+unsigned long millis();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int  digitalRead(uint8_t pin);
+void analogWrite(uint8_t pin, int val);
+int  analogRead(uint8_t pin);
+
+// No interrupts on the host, the emulated StepTimer runs from the foreground
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+/// The hardware serial port, fed from the simulator script at the configured baud rate.
+/// Like the AVR core, both directions are buffered 64 bytes: received bytes are lost
+/// if the buffer is full, and writes block until there is room.
+class HardwareSerial
+{
+public:
+    void    begin(unsigned long baud);
+    void    end() {}
+    int     available();
+    int     peek();
+    int     read();
+    int     availableForWrite();
+    void    flush();
+
+    size_t  write(uint8_t c);
+    size_t  write(const uint8_t* buffer, size_t size);
+    size_t  write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+    size_t  write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+
+    size_t  print(const char* s) { return write(s); }
+    size_t  print(char c) { return write((uint8_t)c); }
+    size_t  print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t  print(int n, int base = DEC) { return print((long)n, base); }
+    size_t  print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t  print(long n, int base = DEC);
+    size_t  print(unsigned long n, int base = DEC);
+    size_t  print(double n, int digits = 2);
+
+    size_t  println() { return write("\r\n"); }
+    template <typename T> size_t println(T v) { size_t n = print(v); return n + println(); }
+    template <typename T> size_t println(T v, int f) { size_t n = print(v, f); return n + println(); }
+
+    operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif
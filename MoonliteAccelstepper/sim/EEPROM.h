@@ -0,0 +1,40 @@
+// EEPROM.h
+//
+// The AVR EEPROM library's interface, on top of the simulator's EEPROM
+
+#ifndef EEPROM_h
+#define EEPROM_h
+
+#include <string.h>
+#include "Arduino.h"
+
+/// The EEPROM, 1024 bytes as on the ATmega328P. It starts erased, all 0xff,
+/// unless moonsim -E loads it from an earlier run.
+class EEPROMClass
+{
+public:
+    uint8_t read(int idx);
+    void    write(int idx, uint8_t val);
+    void    update(int idx, uint8_t val) { if (read(idx) != val) write(idx, val); }
+    uint16_t length();
+
+    template <typename T> T& get(int idx, T& t)
+    {
+	uint8_t* p = (uint8_t*)&t;
+	for (size_t i = 0; i < sizeof(T); i++)
+	    p[i] = read(idx + i);
+	return t;
+    }
+
+    template <typename T> const T& put(int idx, const T& t)
+    {
+	const uint8_t* p = (const uint8_t*)&t;
+	for (size_t i = 0; i < sizeof(T); i++)
+	    update(idx + i, p[i]);
+	return t;
+    }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
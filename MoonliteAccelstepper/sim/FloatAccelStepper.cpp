@@ -0,0 +1,9 @@
+// FloatAccelStepper.cpp
+//
+// Builds AccelStepper.cpp a second time, with the floating point ramp, as
+// FloatAccelStepper. See FloatAccelStepper.h.
+
+#undef ACCELSTEPPER_FIXED_POINT
+#define ACCELSTEPPER_FIXED_POINT 0
+#define AccelStepper FloatAccelStepper
+#include "../src/AccelStepper/AccelStepper.cpp"
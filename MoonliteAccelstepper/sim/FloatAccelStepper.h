@@ -0,0 +1,23 @@
+// FloatAccelStepper.h
+//
+// AccelStepper as it is built without ACCELSTEPPER_FIXED_POINT, renamed so it can be
+// linked alongside the fixed point build the simulator uses everywhere else. Lets
+// motiontest and rampbench run the same moves through both ramps.
+// See FloatAccelStepper.cpp for the other half.
+
+#ifndef FloatAccelStepper_h
+#define FloatAccelStepper_h
+
+#include "../src/AccelStepper/AccelStepper.h"
+
+// Include the header again, with its guard cleared, as a class of another name
+#pragma push_macro("ACCELSTEPPER_FIXED_POINT")
+#undef ACCELSTEPPER_FIXED_POINT
+#define ACCELSTEPPER_FIXED_POINT 0
+#undef AccelStepper_h
+#define AccelStepper FloatAccelStepper
+#include "../src/AccelStepper/AccelStepper.h"
+#undef AccelStepper
+#pragma pop_macro("ACCELSTEPPER_FIXED_POINT")
+
+#endif
@@ -0,0 +1,421 @@
+// Sim.cpp
+//
+// The simulated world, and the Arduino API implemented on top of it
+
+#include "Sim.h"
+#include "EEPROM.h"
+
+Sim sim;
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+
+// Steps further apart than this are between moves, and left out of the interval statistics
+#define SIM_STEP_GAP 100000
+
+Sim::Sim()
+    : microsCost(4),
+      loopCost(10),
+      _now(0),
+      _edges(0),
+      _stepPin(0xff),
+      _steps(0),
+      _lastStep(0),
+      _minInterval(0xffffffff),
+      _maxInterval(0),
+      _byteTime(1042), // 9600 baud until Serial.begin()
+      _rxFree(0),
+      _rxHead(0),
+      _rxCount(0),
+      _rxOverflows(0),
+      _txBusyUntil(0),
+      _txBlocked(0),
+      _transcript(0),
+      _txLen(0),
+      _txLineTime(0)
+{
+    // The pin state is left to static zero initialisation (INPUT, LOW, no device),
+    // since the sketch's global constructors may already have set some pins up
+    memset(_eeprom, 0xff, sizeof(_eeprom));
+    memset(_eepromWrites, 0, sizeof(_eepromWrites));
+}
+
+void Sim::advance(unsigned long us)
+{
+    _now += us;
+    runDue();
+}
+
+void Sim::at(unsigned long time, std::function<void()> event)
+{
+    _events.insert(std::make_pair(time, event));
+}
+
+void Sim::runDue()
+{
+    while (!_events.empty() && _events.begin()->first <= _now)
+    {
+	std::function<void()> event = _events.begin()->second;
+	_events.erase(_events.begin());
+	event();
+    }
+}
+
+void Sim::sendSerial(unsigned long time, const char* text)
+{
+    if (_transcript)
+    {
+	std::string logged(text);
+	at(time, [this, logged]() { fprintf(_transcript, "%10.3f < %s\n", _now / 1000.0, logged.c_str()); });
+    }
+    sendSerial(time, (const uint8_t*)text, strlen(text));
+}
+
+void Sim::sendSerial(unsigned long time, const uint8_t* data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+	// A byte is received once its stop bit is in
+	unsigned long start = max(time, _rxFree);
+	_rxFree = start + _byteTime;
+	uint8_t c = data[i];
+	at(_rxFree, [this, c]() {
+	    if (_rxCount >= SIM_SERIAL_BUFFER)
+	    {
+		_rxOverflows++;
+		return;
+	    }
+	    _rx[(_rxHead + _rxCount) % SIM_SERIAL_BUFFER] = c;
+	    _rxCount++;
+	});
+    }
+}
+
+void Sim::attach(uint8_t pin, SimPinDevice* device)
+{
+    _devices[pin] = device;
+}
+
+void Sim::report(FILE* f)
+{
+    endLine();
+    fprintf(f, "time %.3f ms\n", _now / 1000.0);
+    fprintf(f, "steps %lu", _steps);
+    if (_maxInterval)
+	fprintf(f, ", interval min %lu us max %lu us", _minInterval, _maxInterval);
+    fprintf(f, "\n");
+    fprintf(f, "serial rx overflows %lu, tx blocked %lu us\n", _rxOverflows, _txBlocked);
+
+    // Each cell is good for about 100000 writes, so the most written one matters more than the total
+    unsigned long writes = 0;
+    int most = 0;
+    for (int i = 0; i < SIM_EEPROM_SIZE; i++)
+    {
+	writes += _eepromWrites[i];
+	if (_eepromWrites[i] > _eepromWrites[most])
+	    most = i;
+    }
+    fprintf(f, "eeprom writes %lu, most %lu at %d\n", writes, (unsigned long)_eepromWrites[most], most);
+}
+
+bool Sim::loadEeprom(const char* path)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f)
+	return true;
+    bool ok = fread(_eeprom, 1, sizeof(_eeprom), f) == sizeof(_eeprom);
+    fclose(f);
+    return ok;
+}
+
+bool Sim::saveEeprom(const char* path)
+{
+    FILE* f = fopen(path, "wb");
+    if (!f)
+	return false;
+    bool ok = fwrite(_eeprom, 1, sizeof(_eeprom), f) == sizeof(_eeprom);
+    return fclose(f) == 0 && ok;
+}
+
+void Sim::updateDrive(uint8_t pin)
+{
+    bool low = _mode[pin] == OUTPUT && _level[pin] == LOW;
+    if (low == _low[pin])
+	return;
+    _low[pin] = low;
+    if (_devices[pin])
+	_devices[pin]->driven(_now, low);
+}
+
+void Sim::pinMode(uint8_t pin, uint8_t mode)
+{
+    if (pin >= SIM_PINS)
+	return;
+    _mode[pin] = mode;
+    updateDrive(pin);
+}
+
+void Sim::digitalWrite(uint8_t pin, uint8_t val)
+{
+    if (pin >= SIM_PINS)
+	return;
+    val = val ? HIGH : LOW;
+    if (val != _level[pin])
+    {
+	if (_edges && !_devices[pin])
+	    fprintf(_edges, "%lu,%u,%u\n", _now, pin, val);
+	if (pin == _stepPin && val == HIGH)
+	{
+	    if (_steps)
+	    {
+		unsigned long interval = _now - _lastStep;
+		if (interval < SIM_STEP_GAP)
+		{
+		    _minInterval = min(_minInterval, interval);
+		    _maxInterval = max(_maxInterval, interval);
+		}
+	    }
+	    _steps++;
+	    _lastStep = _now;
+	}
+    }
+    _level[pin] = val;
+    updateDrive(pin);
+}
+
+int Sim::digitalRead(uint8_t pin)
+{
+    if (pin >= SIM_PINS)
+	return LOW;
+    if (_devices[pin])
+	return (_low[pin] || _devices[pin]->pullsLow(_now)) ? LOW : HIGH;
+    if (_mode[pin] == INPUT_PULLUP)
+	return HIGH;
+    return _level[pin];
+}
+
+void Sim::serialBegin(unsigned long baud)
+{
+    _byteTime = 10000000UL / baud; // 8N1 is 10 bits a byte
+}
+
+int Sim::serialAvailable()
+{
+    return _rxCount;
+}
+
+int Sim::serialPeek()
+{
+    return _rxCount ? _rx[_rxHead] : -1;
+}
+
+int Sim::serialRead()
+{
+    if (!_rxCount)
+	return -1;
+    uint8_t c = _rx[_rxHead];
+    _rxHead = (_rxHead + 1) % SIM_SERIAL_BUFFER;
+    _rxCount--;
+    return c;
+}
+
+int Sim::serialAvailableForWrite()
+{
+    unsigned long queued = (_txBusyUntil > _now) ? (_txBusyUntil - _now + _byteTime - 1) / _byteTime : 0;
+    return (queued >= SIM_SERIAL_BUFFER) ? 0 : SIM_SERIAL_BUFFER - queued;
+}
+
+void Sim::serialWrite(uint8_t c)
+{
+    // The buffer holds SIM_SERIAL_BUFFER bytes as well as the one being shifted out.
+    // When it is full, wait for a byte to go like the AVR core does.
+    unsigned long full = _txBusyUntil > SIM_SERIAL_BUFFER * _byteTime ? _txBusyUntil - SIM_SERIAL_BUFFER * _byteTime : 0;
+    if (_now < full)
+    {
+	_txBlocked += full - _now;
+	advance(full - _now);
+    }
+    _txBusyUntil = max(_txBusyUntil, _now) + _byteTime;
+    if (_txListener)
+    {
+	std::function<void(uint8_t)> listener = _txListener;
+	at(_txBusyUntil, [listener, c]() { listener(c); });
+    }
+
+    if (!_transcript)
+	return;
+    if (!_txLen)
+	_txLineTime = _now;
+    if (c != '\r' && c != '\n' && _txLen < sizeof(_txLine) - 1)
+	_txLine[_txLen++] = c;
+    if (c == '#' || c == '\n')
+	endLine();
+}
+
+void Sim::serialFlush()
+{
+    if (_txBusyUntil > _now)
+	advance(_txBusyUntil - _now);
+}
+
+uint8_t Sim::eepromRead(int idx)
+{
+    return (idx >= 0 && idx < SIM_EEPROM_SIZE) ? _eeprom[idx] : 0xff;
+}
+
+void Sim::eepromWrite(int idx, uint8_t val)
+{
+    // An erase and write cycle, 3.3ms on the AVR
+    if (idx < 0 || idx >= SIM_EEPROM_SIZE)
+	return;
+    _eeprom[idx] = val;
+    _eepromWrites[idx]++;
+    advance(3300);
+}
+
+void Sim::endLine()
+{
+    if (!_transcript || !_txLen)
+	return;
+    _txLine[_txLen] = 0;
+    fprintf(_transcript, "%10.3f > %s\n", _txLineTime / 1000.0, _txLine);
+    _txLen = 0;
+}
+
+// The Arduino API
+
+unsigned long micros()
+{
+    sim.advance(sim.microsCost);
+    return sim.now();
+}
+
+unsigned long millis()
+{
+    sim.advance(sim.microsCost);
+    return sim.now() / 1000;
+}
+
+void delay(unsigned long ms)
+{
+    sim.advance(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    sim.advance(us);
+}
+
+void yield()
+{
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    sim.pinMode(pin, mode);
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+    sim.digitalWrite(pin, val);
+}
+
+int digitalRead(uint8_t pin)
+{
+    return sim.digitalRead(pin);
+}
+
+void analogWrite(uint8_t pin, int val)
+{
+    pinMode(pin, OUTPUT);
+}
+
+int analogRead(uint8_t pin)
+{
+    return 0;
+}
+
+void HardwareSerial::begin(unsigned long baud)
+{
+    sim.serialBegin(baud);
+}
+
+int HardwareSerial::available()
+{
+    return sim.serialAvailable();
+}
+
+int HardwareSerial::peek()
+{
+    return sim.serialPeek();
+}
+
+int HardwareSerial::read()
+{
+    return sim.serialRead();
+}
+
+int HardwareSerial::availableForWrite()
+{
+    return sim.serialAvailableForWrite();
+}
+
+void HardwareSerial::flush()
+{
+    sim.serialFlush();
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    sim.serialWrite(c);
+    return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+	sim.serialWrite(buffer[i]);
+    return size;
+}
+
+uint8_t EEPROMClass::read(int idx)
+{
+    return sim.eepromRead(idx);
+}
+
+void EEPROMClass::write(int idx, uint8_t val)
+{
+    sim.eepromWrite(idx, val);
+}
+
+uint16_t EEPROMClass::length()
+{
+    return SIM_EEPROM_SIZE;
+}
+
+size_t HardwareSerial::print(long n, int base)
+{
+    if (n < 0 && base == DEC)
+	return print('-') + print((unsigned long)-n, base);
+    return print((unsigned long)n, base);
+}
+
+size_t HardwareSerial::print(unsigned long n, int base)
+{
+    char buf[8 * sizeof(long) + 1];
+    char* s = &buf[sizeof(buf) - 1];
+    *s = 0;
+    do
+    {
+	uint8_t digit = n % base;
+	*--s = digit < 10 ? '0' + digit : 'A' + digit - 10;
+	n /= base;
+    } while (n);
+    return write(s);
+}
+
+size_t HardwareSerial::print(double n, int digits)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*f", digits, n);
+    return write(buf);
+}
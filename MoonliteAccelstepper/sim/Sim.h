@@ -0,0 +1,175 @@
+// Sim.h
+//
+// Simulator side of the host build: the virtual clock, scheduled events,
+// recorded pin edges, the serial line and devices attached to pins.
+
+#ifndef Sim_h
+#define Sim_h
+
+#include <stdio.h>
+#include <functional>
+#include <map>
+#include <string>
+#include "Arduino.h"
+
+/// Number of pins the simulator keeps state for
+#define SIM_PINS 64
+
+/// Size of the serial receive and transmit buffers, as in the AVR core
+#define SIM_SERIAL_BUFFER 64
+
+/// Size of the EEPROM, as on the ATmega328P
+#define SIM_EEPROM_SIZE 1024
+
+/////////////////////////////////////////////////////////////////////
+/// \class SimPinDevice Sim.h <Sim.h>
+/// \brief Something connected to a pin, that the firmware drives and reads back
+///
+/// The line is modelled as open drain with a pull up: it is low if either the
+/// firmware or the device is pulling it low.
+class SimPinDevice
+{
+public:
+    virtual ~SimPinDevice() {}
+
+    /// Called whenever the firmware starts or stops pulling the line low
+    /// \param[in] now Virtual time in microseconds
+    /// \param[in] low true if the firmware is now pulling the line low
+    virtual void    driven(unsigned long now, bool low) = 0;
+
+    /// \param[in] now Virtual time in microseconds
+    /// \return true if the device is pulling the line low
+    virtual bool    pullsLow(unsigned long now) = 0;
+};
+
+/////////////////////////////////////////////////////////////////////
+/// \class Sim Sim.h <Sim.h>
+/// \brief The simulated world the firmware runs in
+///
+/// There is a single instance, sim. All time is virtual and deterministic: it moves on
+/// when the firmware delays, when it calls micros() or millis() (each charged microsCost),
+/// and by loopCost after each loop(). Events scheduled with at() run as the clock passes them.
+class Sim
+{
+public:
+    Sim();
+
+    /// \return the virtual time in microseconds
+    unsigned long now() { return _now; }
+
+    /// Moves the clock on, running any events and serial traffic that fall due
+    /// \param[in] us Microseconds to advance
+    void    advance(unsigned long us);
+
+    /// Schedules an event
+    /// \param[in] time Virtual time in microseconds to run it at
+    /// \param[in] event The event
+    void    at(unsigned long time, std::function<void()> event);
+
+    /// Schedules text to arrive on the serial port, one byte time after another, after anything already sent
+    /// \param[in] time Virtual time in microseconds that the first byte arrives
+    /// \param[in] text The bytes to send
+    void    sendSerial(unsigned long time, const char* text);
+
+    /// Schedules bytes to arrive on the serial port, as sendSerial() but binary and left out of the transcript
+    /// \param[in] time Virtual time in microseconds that the first byte arrives
+    /// \param[in] data The bytes to send
+    /// \param[in] len How many
+    void    sendSerial(unsigned long time, const uint8_t* data, size_t len);
+
+    /// Connects a device to a pin
+    void    attach(uint8_t pin, SimPinDevice* device);
+
+    /// Writes every level change the firmware makes on the output pins to f, as
+    /// "time_us,pin,level" lines. Pins with a device attached are left out.
+    void    recordEdges(FILE* f) { _edges = f; }
+
+    /// Writes a timestamped transcript of the serial traffic to f
+    void    recordSerial(FILE* f) { _transcript = f; }
+
+    /// Passes each byte the firmware sends to listener, as its stop bit goes out
+    void    onTransmit(std::function<void(uint8_t)> listener) { _txListener = listener; }
+
+    /// Selects the pin whose rising edges are counted as steps
+    void    setStepPin(uint8_t pin) { _stepPin = pin; }
+
+    /// Prints the step, serial and EEPROM statistics
+    void    report(FILE* f);
+
+    /// Fills the EEPROM from a file written by saveEeprom(). A missing file leaves it erased.
+    /// \return false if the file exists but could not be read
+    bool    loadEeprom(const char* path);
+
+    /// Writes the EEPROM contents to a file, for loadEeprom() on the next run
+    /// \return false if the file could not be written
+    bool    saveEeprom(const char* path);
+
+    /// Microseconds charged for each call to micros() or millis()
+    unsigned long microsCost;
+
+    /// Microseconds charged after each loop()
+    unsigned long loopCost;
+
+    // The rest is the state behind the Arduino API in Sim.cpp
+
+    void    pinMode(uint8_t pin, uint8_t mode);
+    void    digitalWrite(uint8_t pin, uint8_t val);
+    int     digitalRead(uint8_t pin);
+
+    void    serialBegin(unsigned long baud);
+    int     serialAvailable();
+    int     serialPeek();
+    int     serialRead();
+    int     serialAvailableForWrite();
+    void    serialWrite(uint8_t c);
+    void    serialFlush();
+
+    uint8_t eepromRead(int idx);
+    void    eepromWrite(int idx, uint8_t val);
+
+private:
+    /// Tells the device on pin if the firmware's pull down changed
+    void    updateDrive(uint8_t pin);
+
+    /// Runs events and serial arrivals up to now
+    void    runDue();
+
+    /// Flushes the partial transmit line to the transcript
+    void    endLine();
+
+    unsigned long   _now;
+    std::multimap<unsigned long, std::function<void()> > _events;
+
+    uint8_t         _mode[SIM_PINS];
+    uint8_t         _level[SIM_PINS];
+    bool            _low[SIM_PINS];
+    SimPinDevice*   _devices[SIM_PINS];
+    FILE*           _edges;
+
+    uint8_t         _stepPin;
+    unsigned long   _steps;
+    unsigned long   _lastStep;
+    unsigned long   _minInterval;
+    unsigned long   _maxInterval;
+
+    unsigned long   _byteTime;
+    unsigned long   _rxFree;
+    uint8_t         _rx[SIM_SERIAL_BUFFER];
+    uint8_t         _rxHead;
+    uint8_t         _rxCount;
+    unsigned long   _rxOverflows;
+    unsigned long   _txBusyUntil;
+    unsigned long   _txBlocked;
+    FILE*           _transcript;
+    std::function<void(uint8_t)> _txListener;
+    char            _txLine[256];
+    uint8_t         _txLen;
+    unsigned long   _txLineTime;
+
+    uint8_t         _eeprom[SIM_EEPROM_SIZE];
+    uint32_t        _eepromWrites[SIM_EEPROM_SIZE];
+};
+
+extern Sim sim;
+
+#endif
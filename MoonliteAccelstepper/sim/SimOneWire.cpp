@@ -0,0 +1,326 @@
+// SimOneWire.cpp
+//
+// Bit level model of a 1-Wire bus with DS18B20 temperature sensors on it
+
+#include "SimOneWire.h"
+
+// ROM commands
+#define READ_ROM        0x33
+#define MATCH_ROM_CMD   0x55
+#define SKIP_ROM        0xCC
+#define SEARCH_ROM_CMD  0xF0
+#define ALARM_SEARCH    0xEC
+
+// Function commands
+#define CONVERT_T       0x44
+#define READ_SCRATCH    0xBE
+#define WRITE_SCRATCH   0x4E
+#define COPY_SCRATCH    0x48
+#define RECALL_EEPROM   0xB8
+#define READ_POWER      0xB4
+
+// Low pulses at least this long are a reset
+#define RESET_US        480
+// Write slots released before this are a 1
+#define SAMPLE_US       15
+// How long a 0 is held for when sending
+#define HOLD_US         30
+// Presence pulse, after the end of the reset
+#define PRESENCE_US     15
+#define PRESENCE_LEN_US 120
+// 9 bit conversion time, doubling for each extra bit
+#define CONVERT_9BIT_US 93750UL
+
+SimDS18B20::SimDS18B20(uint32_t serial, float celsius)
+    : _celsius(celsius),
+      _conversions(0),
+      _convertDone(0),
+      _converting(false),
+      _state(IDLE),
+      _byte(0),
+      _bits(0),
+      _txLen(0),
+      _txBit(0),
+      _rxLen(0),
+      _searchBit(0),
+      _searchPhase(0),
+      _afterTx(IDLE),
+      _holdFrom(0),
+      _holdUntil(0)
+{
+    _rom[0] = 0x28; // DS18B20 family
+    for (uint8_t i = 1; i < 7; i++)
+	_rom[i] = i < 5 ? (serial >> (8 * (i - 1))) & 0xff : 0;
+    _rom[7] = crc8(_rom, 7);
+
+    // Power on state, 85C until the first conversion
+    static const uint8_t powerOn[8] = { 0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10 };
+    memcpy(_scratchpad, powerOn, 8);
+    _scratchpad[8] = crc8(_scratchpad, 8);
+    memcpy(_eeprom, &_scratchpad[2], 3);
+}
+
+uint8_t SimDS18B20::crc8(const uint8_t* data, uint8_t len)
+{
+    uint8_t crc = 0;
+    while (len--)
+    {
+	uint8_t in = *data++;
+	for (uint8_t i = 8; i; i--)
+	{
+	    uint8_t mix = (crc ^ in) & 0x01;
+	    crc >>= 1;
+	    if (mix)
+		crc ^= 0x8C;
+	    in >>= 1;
+	}
+    }
+    return crc;
+}
+
+void SimDS18B20::reset(unsigned long now)
+{
+    if (_converting && now >= _convertDone)
+	finishConversion();
+    _state = ROM_COMMAND;
+    _byte = 0;
+    _bits = 0;
+    _holdFrom = now + PRESENCE_US;
+    _holdUntil = _holdFrom + PRESENCE_LEN_US;
+}
+
+void SimDS18B20::slotStart(unsigned long now)
+{
+    if (_converting && now >= _convertDone)
+	finishConversion();
+    bool bit;
+    if (sending(&bit) && !bit)
+    {
+	_holdFrom = now;
+	_holdUntil = now + HOLD_US;
+    }
+}
+
+void SimDS18B20::slotEnd(unsigned long now, unsigned long length)
+{
+    bool bit;
+    if (!sending(&bit))
+    {
+	received(length < SAMPLE_US, now);
+	return;
+    }
+
+    // A read slot, move on to the next bit
+    if (_state == TRANSMIT)
+    {
+	if (++_txBit >= _txLen * 8)
+	    _state = _afterTx;
+    }
+    else if (_state == SEARCH_ROM)
+	_searchPhase++;
+}
+
+bool SimDS18B20::sending(bool* bit)
+{
+    switch (_state)
+    {
+	case TRANSMIT:
+	    *bit = (_tx[_txBit / 8] >> (_txBit % 8)) & 1;
+	    return true;
+
+	case SEARCH_ROM:
+	    if (_searchPhase > 1)
+		return false;
+	    *bit = ((_rom[_searchBit / 8] >> (_searchBit % 8)) & 1) ^ _searchPhase;
+	    return true;
+
+	case STATUS:
+	    // Convert reads 0 until done, the others are done straight away.
+	    // Read power supply reads 1, externally powered.
+	    *bit = !_converting;
+	    return true;
+
+	default:
+	    return false;
+    }
+}
+
+void SimDS18B20::received(bool bit, unsigned long now)
+{
+    if (_state == SEARCH_ROM)
+    {
+	// The direction the master chose, drop out if it is not ours
+	bool ours = (_rom[_searchBit / 8] >> (_searchBit % 8)) & 1;
+	if (bit != ours)
+	    _state = IDLE;
+	else if (++_searchBit == 64)
+	    _state = FUNCTION;
+	_searchPhase = 0;
+	return;
+    }
+    if (_state == IDLE || _state == STATUS)
+	return;
+
+    // Bytes are sent LSB first
+    if (bit)
+	_byte |= 1 << _bits;
+    if (++_bits < 8)
+	return;
+    uint8_t b = _byte;
+    _byte = 0;
+    _bits = 0;
+
+    switch (_state)
+    {
+	case ROM_COMMAND:
+	    if (b == READ_ROM)
+		transmit(_rom, 8, FUNCTION);
+	    else if (b == MATCH_ROM_CMD)
+	    {
+		_state = MATCH_ROM;
+		_rxLen = 0;
+	    }
+	    else if (b == SKIP_ROM)
+		_state = FUNCTION;
+	    else if (b == SEARCH_ROM_CMD || b == ALARM_SEARCH)
+	    {
+		int8_t t = (int16_t)(_scratchpad[1] << 8 | _scratchpad[0]) >> 4;
+		bool alarm = t >= (int8_t)_scratchpad[2] || t <= (int8_t)_scratchpad[3];
+		_state = (b == SEARCH_ROM_CMD || alarm) ? SEARCH_ROM : IDLE;
+		_searchBit = 0;
+		_searchPhase = 0;
+	    }
+	    else
+		_state = IDLE;
+	    break;
+
+	case MATCH_ROM:
+	    if (b != _rom[_rxLen])
+		_state = IDLE;
+	    else if (++_rxLen == 8)
+		_state = FUNCTION;
+	    break;
+
+	case FUNCTION:
+	    command(b, now);
+	    break;
+
+	case RECEIVE:
+	    // TH, TL and config
+	    _scratchpad[2 + _rxLen] = b;
+	    if (++_rxLen == 3)
+	    {
+		_scratchpad[8] = crc8(_scratchpad, 8);
+		_state = IDLE;
+	    }
+	    break;
+
+	default:
+	    break;
+    }
+}
+
+void SimDS18B20::command(uint8_t cmd, unsigned long now)
+{
+    switch (cmd)
+    {
+	case CONVERT_T:
+	{
+	    uint8_t resolution = 9 + ((_scratchpad[4] >> 5) & 3);
+	    _converting = true;
+	    _convertDone = now + (CONVERT_9BIT_US << (resolution - 9));
+	    _conversions++;
+	    _state = STATUS;
+	    break;
+	}
+
+	case READ_SCRATCH:
+	    transmit(_scratchpad, 9, IDLE);
+	    break;
+
+	case WRITE_SCRATCH:
+	    _state = RECEIVE;
+	    _rxLen = 0;
+	    break;
+
+	case COPY_SCRATCH:
+	    memcpy(_eeprom, &_scratchpad[2], 3);
+	    _state = STATUS;
+	    break;
+
+	case RECALL_EEPROM:
+	    memcpy(&_scratchpad[2], _eeprom, 3);
+	    _scratchpad[8] = crc8(_scratchpad, 8);
+	    _state = STATUS;
+	    break;
+
+	case READ_POWER:
+	    _state = STATUS;
+	    break;
+
+	default:
+	    _state = IDLE;
+	    break;
+    }
+}
+
+void SimDS18B20::finishConversion()
+{
+    // Round to the configured resolution, 12 bits is 1/16C
+    uint8_t resolution = 9 + ((_scratchpad[4] >> 5) & 3);
+    int16_t raw = (int16_t)lround(_celsius * 16.0);
+    raw &= ~((1 << (12 - resolution)) - 1);
+    _scratchpad[0] = raw & 0xff;
+    _scratchpad[1] = (raw >> 8) & 0xff;
+    _scratchpad[8] = crc8(_scratchpad, 8);
+    _converting = false;
+}
+
+void SimDS18B20::transmit(const uint8_t* data, uint8_t len, State after)
+{
+    memcpy(_tx, data, len);
+    _txLen = len;
+    _txBit = 0;
+    _afterTx = after;
+    _state = TRANSMIT;
+}
+
+SimOneWireBus::SimOneWireBus()
+    : _fell(0),
+      _resets(0),
+      _slots(0)
+{
+}
+
+void SimOneWireBus::driven(unsigned long now, bool low)
+{
+    if (low)
+    {
+	_fell = now;
+	for (size_t i = 0; i < _devices.size(); i++)
+	    _devices[i]->slotStart(now);
+	return;
+    }
+
+    unsigned long length = now - _fell;
+    if (length >= RESET_US)
+    {
+	_resets++;
+	for (size_t i = 0; i < _devices.size(); i++)
+	    _devices[i]->reset(now);
+    }
+    else
+    {
+	_slots++;
+	for (size_t i = 0; i < _devices.size(); i++)
+	    _devices[i]->slotEnd(now, length);
+    }
+}
+
+bool SimOneWireBus::pullsLow(unsigned long now)
+{
+    for (size_t i = 0; i < _devices.size(); i++)
+	if (now >= _devices[i]->_holdFrom && now < _devices[i]->_holdUntil)
+	    return true;
+    return false;
+}
@@ -0,0 +1,119 @@
+// SimOneWire.h
+//
+// Bit level model of a 1-Wire bus with DS18B20 temperature sensors on it
+
+#ifndef SimOneWire_h
+#define SimOneWire_h
+
+#include <vector>
+#include "Sim.h"
+
+class SimOneWireBus;
+
+/////////////////////////////////////////////////////////////////////
+/// \class SimDS18B20 SimOneWire.h <SimOneWire.h>
+/// \brief A DS18B20 on a SimOneWireBus
+///
+/// Decodes the time slots the firmware generates the same way the real part does:
+/// a low pulse of 480us or more is a reset, a write slot shorter than 15us is a 1, and
+/// when the part is sending it holds the line low for 30us from the start of a slot for a 0.
+/// Supports the ROM commands (read, match, skip, search and alarm search) and the function
+/// commands convert, read/write/copy scratchpad, recall and read power supply.
+/// Conversions take the datasheet time for the configured resolution.
+class SimDS18B20
+{
+public:
+    /// \param[in] serial Serial number for the ROM code, the family code and CRC are added
+    /// \param[in] celsius The initial temperature
+    SimDS18B20(uint32_t serial, float celsius);
+
+    /// Sets the temperature the next conversion reads
+    void    setTemperature(float celsius) { _celsius = celsius; }
+
+    /// \return the ROM code
+    const uint8_t* rom() { return _rom; }
+
+    /// \return the number of conversions started
+    unsigned long conversions() { return _conversions; }
+
+private:
+    friend class SimOneWireBus;
+
+    typedef enum
+    {
+	IDLE,           ///< Not selected, ignoring the bus until the next reset
+	ROM_COMMAND,    ///< Receiving the ROM command
+	MATCH_ROM,      ///< Receiving a ROM code to compare with our own
+	SEARCH_ROM,     ///< Taking part in a search
+	FUNCTION,       ///< Receiving the function command
+	RECEIVE,        ///< Receiving scratchpad bytes
+	TRANSMIT,       ///< Sending _tx
+	STATUS          ///< Every read slot returns _status
+    } State;
+
+    void    reset(unsigned long now);
+    void    slotStart(unsigned long now);
+    void    slotEnd(unsigned long now, unsigned long length);
+    bool    sending(bool* bit);
+    void    received(bool bit, unsigned long now);
+    void    command(uint8_t cmd, unsigned long now);
+    void    finishConversion();
+    void    transmit(const uint8_t* data, uint8_t len, State after);
+    static uint8_t crc8(const uint8_t* data, uint8_t len);
+
+    uint8_t         _rom[8];
+    uint8_t         _scratchpad[9];
+    uint8_t         _eeprom[3];
+    float           _celsius;
+    unsigned long   _conversions;
+    unsigned long   _convertDone;
+    bool            _converting;
+
+    State           _state;
+    uint8_t         _byte;
+    uint8_t         _bits;
+    uint8_t         _tx[9];
+    uint8_t         _txLen;
+    uint8_t         _txBit;
+    uint8_t         _rxLen;
+    uint8_t         _searchBit;
+    uint8_t         _searchPhase;
+    State           _afterTx;
+    unsigned long   _holdFrom;
+    unsigned long   _holdUntil;
+};
+
+/////////////////////////////////////////////////////////////////////
+/// \class SimOneWireBus SimOneWire.h <SimOneWire.h>
+/// \brief The 1-Wire bus, a wired AND of the firmware and all the devices on it
+class SimOneWireBus : public SimPinDevice
+{
+public:
+    SimOneWireBus();
+
+    /// Connects a sensor to the bus
+    void    add(SimDS18B20* device) { _devices.push_back(device); }
+
+    /// \return the number of sensors on the bus
+    uint8_t count() { return _devices.size(); }
+
+    /// \return a sensor on the bus, in the order they were added
+    SimDS18B20* device(uint8_t i) { return _devices[i]; }
+
+    /// \return the number of resets the firmware has sent
+    unsigned long resets() { return _resets; }
+
+    /// \return the number of read and write time slots the firmware has generated
+    unsigned long slots() { return _slots; }
+
+    virtual void driven(unsigned long now, bool low);
+    virtual bool pullsLow(unsigned long now);
+
+private:
+    std::vector<SimDS18B20*> _devices;
+    unsigned long   _fell;
+    unsigned long   _resets;
+    unsigned long   _slots;
+};
+
+#endif
@@ -0,0 +1,90 @@
+// hexbench.cpp
+//
+// Compares the Moonlite hex responses and parameter parsing in MoonliteHex
+// with the sprintf/strtol code they replaced, on the host.
+//
+// Usage: hexbench [iterations]
+//
+// Host timings only show the relative cost; on the AVR sprintf and strtol are
+// slower still compared to the few shifts hexEncode and hexDecode need. Output
+// goes to a sink that only counts the bytes and write calls, so the serial
+// line does not dominate.
+
+#include <chrono>
+#include "Arduino.h"
+#include "../src/MoonliteHex/MoonliteHex.h"
+
+// Stand in for Serial that counts instead of sending
+struct Sink
+{
+    unsigned long bytes;
+    unsigned long writes;
+
+    size_t write(const char* buffer, size_t size) { bytes += size; writes++; return size; }
+    size_t print(const char* s) { return write(s, strlen(s)); }
+};
+
+static Sink sink;
+
+// What GP and friends did before
+static void oldReply(long value)
+{
+    char tempString[6];
+    // The AVR's int is 16 bits, keep the host to the same 4 digits
+    sprintf(tempString, "%04X", (unsigned)(value & 0xffff));
+    sink.print(tempString);
+    sink.print("#");
+}
+
+static void newReply(long value)
+{
+    char response[HEX_MAX_DIGITS + 1];
+    sink.write(response, hexResponse(response, value, 4));
+}
+
+template <class F>
+static double bench(const char* what, unsigned long iterations, F f)
+{
+    sink.bytes = sink.writes = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < iterations; i++)
+	f(i);
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+    printf("%-22s %8.1f ns  %5.2f writes  %5.2f bytes\n", what, ns, (double)sink.writes / iterations, (double)sink.bytes / iterations);
+    return ns;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long iterations = argc > 1 ? strtoul(argv[1], 0, 10) : 10000000;
+
+    // Both must agree on every 16 bit value, in both cases on the way in
+    for (long v = 0; v <= 0xffff; v++)
+    {
+	char a[8], b[8];
+	sprintf(a, "%04X", (unsigned)v);
+	*hexEncode(b, v, 4) = 0;
+	if (strcmp(a, b) || hexDecode(a) != (unsigned long)strtol(a, 0, 16))
+	{
+	    printf("mismatch at %04lX: %s %s\n", v, a, b);
+	    return 1;
+	}
+	sprintf(a, "%04x", (unsigned)v);
+	if (hexDecode(a) != (unsigned long)v)
+	{
+	    printf("mismatch at %s\n", a);
+	    return 1;
+	}
+    }
+
+    volatile unsigned long sum = 0;
+    double oldEncode = bench("sprintf + 2 prints", iterations, [](unsigned long i) { oldReply(i); });
+    double newEncode = bench("hexResponse + write", iterations, [](unsigned long i) { newReply(i); });
+
+    static const char* params[] = { "0000", "1A2B", "ffff", "0400", "02" };
+    double oldDecode = bench("strtol", iterations, [&sum](unsigned long i) { sum += strtol(params[i % 5], NULL, 16); });
+    double newDecode = bench("hexDecode", iterations, [&sum](unsigned long i) { sum += hexDecode(params[i % 5]); });
+
+    printf("response %.1fx faster, parse %.1fx faster\n", oldEncode / newEncode, oldDecode / newDecode);
+    return 0;
+}
@@ -0,0 +1,662 @@
+// motiontest.cpp
+//
+// Checks the step timing of AccelStepper and the libraries built on it against the
+// simulator's clock: the steps each move makes, when, and where it ends up.
+//
+// Usage: motiontest
+//
+// Prints a line for each check and exits with 1 if any of them failed, so
+// "make check" can be run before a change goes in. Times are virtual, so the
+// results are the same on every host.
+
+#include <stdarg.h>
+#include <vector>
+#include "Sim.h"
+#include "../src/AccelStepper/AccelStepper.h"
+#include "../src/AccelStepper/MultiStepper.h"
+#include "../src/StepTimer/StepTimer.h"
+#include "../src/Backlash/Backlash.h"
+#include "FloatAccelStepper.h"
+
+// How often the tests poll, like a loop() with nothing else to do
+#define POLL_US 10
+
+// Pins for the test steppers, clear of anything else in the simulator
+#define STEP_PIN 40
+#define DIR_PIN  41
+
+static int failures = 0;
+
+// Reports a check, counting it if it failed
+static void check(bool ok, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    printf("%s ", ok ? "ok  " : "FAIL");
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+    if (!ok)
+	failures++;
+}
+
+// One step, as seen by the motor, with the speed the stepper had planned for it
+struct Step
+{
+    unsigned long time;
+    long          position;
+    float         speed;
+};
+
+// An AccelStepper, or the float build of it, that records its steps instead of driving pins
+template <class Stepper>
+class Recorder : public Stepper
+{
+public:
+    Recorder()
+	: Stepper(Stepper::DRIVER, STEP_PIN, DIR_PIN)
+    {
+    }
+
+    std::vector<Step> steps;
+
+    using Stepper::plannedDistanceToGo;
+
+protected:
+    virtual void step(long)
+    {
+	Step s = { sim.now(), this->currentPosition(), this->speed() };
+	steps.push_back(s);
+    }
+};
+
+typedef Recorder<AccelStepper> RecordingStepper;
+
+// The first step interval of a move from rest, as AccelStepper works it out (Equation 15)
+static float c0(float acceleration)
+{
+    return 0.676 * sqrt(2.0 / acceleration) * 1000000.0;
+}
+
+// Polls the timer until the motor stops, or a minute goes by
+static void runTimer(StepTimer& timer)
+{
+    unsigned long timeout = sim.now() + 60000000;
+    while (timer.run() && sim.now() < timeout)
+	sim.advance(POLL_US);
+}
+
+// The index of the first step after from that goes the other way, or 0 if there is none
+static size_t reversal(const std::vector<Step>& steps, size_t from)
+{
+    for (size_t i = from + 2; i < steps.size(); i++)
+	if ((steps[i].position - steps[i - 1].position) != (steps[i - 1].position - steps[i - 2].position))
+	    return i;
+    return 0;
+}
+
+// The shortest interval between steps, from the step at from on
+static unsigned long minInterval(const std::vector<Step>& steps, size_t from = 0)
+{
+    unsigned long shortest = 0xffffffff;
+    for (size_t i = from + 1; i < steps.size(); i++)
+	shortest = min(shortest, steps[i].time - steps[i - 1].time);
+    return shortest;
+}
+
+// A move started by the timer straight after another one ended, the other way, must not step
+// sooner than a move from rest would
+static void testTimerRestart()
+{
+    RecordingStepper stepper;
+    StepTimer timer(stepper);
+    timer.begin();
+    stepper.setMaxSpeed(2000);
+    stepper.setAcceleration(500);
+
+    timer.moveTo(200);
+    runTimer(timer);
+    size_t first = stepper.steps.size();
+    timer.moveTo(0);
+    runTimer(timer);
+
+    size_t back = reversal(stepper.steps, first - 2);
+    unsigned long gap = back ? stepper.steps[back].time - stepper.steps[back - 1].time : 0;
+    check(back == first && gap >= c0(500) - 1,
+	  "timer: first step after a reversal %lu us after the last, c0 %.0f us", gap, c0(500));
+    check(stepper.currentPosition() == 0, "timer: back at 0, at %ld", stepper.currentPosition());
+}
+
+// A poll that comes a long time late must not make the timer fire every step it missed
+// back to back, any more than runSpeed() would
+static void testTimerCatchUp()
+{
+    RecordingStepper stepper;
+    StepTimer timer(stepper);
+    timer.begin();
+    stepper.setMaxSpeed(2000);
+    stepper.setAcceleration(4000);
+
+    timer.moveTo(4000);
+    // Well into the cruise at 500 us a step, then stall for 40 steps' worth
+    unsigned long stall = sim.now() + 1000000;
+    while (timer.run() && sim.now() < stall)
+	sim.advance(POLL_US);
+    size_t before = stepper.steps.size();
+    sim.advance(20000);
+    runTimer(timer);
+
+    unsigned long shortest = minInterval(stepper.steps, before);
+    check(shortest >= 500 - POLL_US, "timer: shortest interval after a 20 ms stall %lu us, cruising at 500 us", shortest);
+    check(stepper.missedSteps() >= 39, "timer: %lu missed steps counted", stepper.missedSteps());
+    check(stepper.currentPosition() == 4000, "timer: arrived at %ld", stepper.currentPosition());
+}
+
+// Polls runSpeed() until the stepper has taken count steps in all
+static void runSpeedTo(RecordingStepper& stepper, size_t count)
+{
+    while (stepper.steps.size() < count)
+    {
+	stepper.runSpeed();
+	sim.advance(POLL_US);
+    }
+}
+
+// How early and how late the steps from..to are against the schedule that starts at the step
+// at origin, in us, negative if early
+static void drift(const std::vector<Step>& steps, size_t origin, size_t from, size_t to, unsigned long interval,
+		  long& earliest, long& latest)
+{
+    earliest = 0x7fffffff;
+    latest = -0x7fffffff;
+    for (size_t i = from; i < to; i++)
+    {
+	long off = (long)(steps[i].time - steps[origin].time - (i - origin) * interval);
+	earliest = min(earliest, off);
+	latest = max(latest, off);
+    }
+}
+
+// With scheduled stepping a polled runSpeed() makes up a step a late loop() delayed with the
+// next one, so the steps keep to their schedule without drift. A step a whole interval late or
+// more is not caught up: the intervals it lost are dropped and the schedule restarts from it.
+static void testScheduledStepping()
+{
+    RecordingStepper stepper;
+    stepper.setMaxSpeed(2000);
+    stepper.setSpeed(2000);
+    stepper.setScheduledStepping(true);
+    const unsigned long interval = 500;
+    // A step can be this late without the loop() being late, from the poll and micros() itself
+    const long poll = POLL_US + sim.microsCost;
+
+    runSpeedTo(stepper, 20);
+    // A loop() that takes 700 us, so the next step is a little over 200 us late
+    sim.advance(700);
+    runSpeedTo(stepper, 60);
+    unsigned long catchUp = stepper.steps[21].time - stepper.steps[20].time;
+    long earliest, latest;
+    drift(stepper.steps, 0, 21, 60, interval, earliest, latest);
+    check(catchUp < interval - 150 && earliest >= 0 && latest < poll,
+	  "scheduled: step after a 700 us loop() %lu us after the late one, then %ld to %ld us off the schedule",
+	  catchUp, earliest, latest);
+    check(stepper.lateSteps() == 1 && stepper.missedSteps() == 0,
+	  "scheduled: %lu late and %lu missed steps counted for it, 1 and 0 expected",
+	  stepper.lateSteps(), stepper.missedSteps());
+
+    // And one that takes 1800 us, so the next step is 2 whole intervals and a bit late
+    sim.advance(1800);
+    runSpeedTo(stepper, 100);
+    unsigned long restart = minInterval(stepper.steps, 60);
+    drift(stepper.steps, 60, 61, 100, interval, earliest, latest);
+    check(restart >= interval - poll && earliest >= 0 && latest < poll,
+	  "scheduled: after a 1800 us loop() shortest interval %lu us, then %ld to %ld us off the new schedule",
+	  restart, earliest, latest);
+    check(stepper.lateSteps() == 2 && stepper.missedSteps() == 2,
+	  "scheduled: %lu late and %lu missed steps counted in all, 2 and 2 expected",
+	  stepper.lateSteps(), stepper.missedSteps());
+}
+
+// The overshoot and return of a move from the wrong side, driven by motor, which is stepper
+// itself or a StepTimer for it. The return is a new move started the moment the overshoot
+// ends, and its first step must still wait out c0, or a geared focuser gets a step far
+// faster than the ramp allows just as it reverses.
+template <class Motor>
+static void testBacklashReversal(const char* what, RecordingStepper& stepper, Motor& motor)
+{
+    stepper.setMaxSpeed(2000);
+    stepper.setAcceleration(500);
+    Backlash<Motor> backlash(motor);
+    backlash.setDirection(1);
+    backlash.setOvershoot(40);
+
+    stepper.setCurrentPosition(1000);
+    backlash.moveTo(800);
+    unsigned long timeout = sim.now() + 60000000;
+    while (backlash.isRunning() && sim.now() < timeout)
+    {
+	backlash.run();
+	sim.advance(POLL_US);
+    }
+
+    size_t back = reversal(stepper.steps, 0);
+    unsigned long gap = back ? stepper.steps[back].time - stepper.steps[back - 1].time : 0;
+    check(back && stepper.steps[back - 1].position == 760 && gap >= c0(500) - 1,
+	  "%s: backlash return %lu us after the overshoot, c0 %.0f us", what, gap, c0(500));
+    check(minInterval(stepper.steps) >= 1000000 / 2000 - POLL_US, "%s: shortest interval %lu us", what, minInterval(stepper.steps));
+    check(stepper.currentPosition() == 800 && !reversal(stepper.steps, back),
+	  "%s: arrived at %ld from below, reversing once", what, stepper.currentPosition());
+}
+
+// Resetting the position part way through the overshoot of a move from the wrong side must
+// forget the return, whose target was in the old positions, and leave the motor where it is
+template <class Motor>
+static void testBacklashReset(const char* what, RecordingStepper& stepper, Motor& motor)
+{
+    stepper.setMaxSpeed(2000);
+    stepper.setAcceleration(500);
+    Backlash<Motor> backlash(motor);
+    backlash.setDirection(1);
+    backlash.setOvershoot(40);
+
+    stepper.setCurrentPosition(1000);
+    backlash.moveTo(800);
+    unsigned long timeout = sim.now() + 60000000;
+    while (stepper.currentPosition() > 900 && sim.now() < timeout)
+    {
+	backlash.run();
+	sim.advance(POLL_US);
+    }
+    backlash.setCurrentPosition(0);
+    size_t before = stepper.steps.size();
+    timeout = sim.now() + 1000000;
+    while (sim.now() < timeout)
+    {
+	backlash.run();
+	sim.advance(POLL_US);
+    }
+
+    check(stepper.currentPosition() == 0 && stepper.steps.size() == before && !backlash.isRunning(),
+	  "%s: reset during the overshoot, %u steps after it, at %ld", what,
+	  (unsigned)(stepper.steps.size() - before), stepper.currentPosition());
+}
+
+// Runs backlash for the given time
+template <class Motor>
+static void runBacklash(Backlash<Motor>& backlash, unsigned long us)
+{
+    unsigned long until = sim.now() + us;
+    while (sim.now() < until)
+    {
+	backlash.run();
+	sim.advance(POLL_US);
+    }
+}
+
+// The worst acceleration between consecutive steps from the step at from on, as a proportion of
+// acceleration. It comes from the planned speeds, less what rounding the intervals to the
+// microsecond can make of it, so jitter in when the steps were polled does not count. The ten
+// steps nearest rest are left out, since Equation 13 is only a rough fit to the ramp there.
+static float worstAcceleration(const std::vector<Step>& steps, size_t from, float acceleration)
+{
+    float creep = sqrtf(2.0f * acceleration * 10);
+    float worst = 0.0;
+    for (size_t i = from + 1; i < steps.size(); i++)
+    {
+	float before = fabsf(steps[i - 1].speed), after = fabsf(steps[i].speed);
+	if (before < creep || after < creep || (steps[i].speed < 0) != (steps[i - 1].speed < 0))
+	    continue;
+	float resolution = before * after * 1e-6f * before;
+	worst = max(worst, (fabsf(after - before) * before - resolution) / acceleration);
+    }
+    return worst;
+}
+
+// Changing the speed of a jog part way must ramp to the new speed, slowing down as well as
+// speeding up, rather than cutting straight to the new step interval, and so must jogging
+// back the other way more slowly. Stopping then ramps down, on the side of the backlash.
+// Each change of target skips a step of the ramp, so the odd step may see twice the acceleration.
+template <class Motor>
+static void testJog(const char* what, RecordingStepper& stepper, Motor& motor)
+{
+    stepper.setMaxSpeed(3200);
+    stepper.setAcceleration(500);
+    Backlash<Motor> backlash(motor);
+    backlash.setDirection(1);
+    backlash.setOvershoot(40);
+
+    backlash.jog(100000, 3200);
+    runBacklash(backlash, 3000000);
+    float fast = fabsf(stepper.speed());
+    backlash.jog(100000, 200);
+    runBacklash(backlash, 3000000);
+    float slow = fabsf(stepper.speed());
+    backlash.jog(100000, 1600);
+    runBacklash(backlash, 2000000);
+    float faster = fabsf(stepper.speed());
+    backlash.jog(-100000, 400);
+    runBacklash(backlash, 4000000);
+    float back = stepper.speed();
+    backlash.stop();
+    runBacklash(backlash, 4000000);
+
+    float worst = worstAcceleration(stepper.steps, 0, 500);
+    size_t turn = reversal(stepper.steps, 0);
+    check(worst <= 2.05 && fast > 1400 && slow == 200 && faster > 900 && back == -400,
+	  "%s: jog at %.0f, slowed to %.0f, up to %.0f, back at %.0f, acceleration %.2f of the limit",
+	  what, fast, slow, faster, back, worst);
+    check(turn && reversal(stepper.steps, turn) && !reversal(stepper.steps, reversal(stepper.steps, turn) + 1)
+	  && !backlash.isRunning() && stepper.steps.back().position > stepper.steps[stepper.steps.size() - 2].position,
+	  "%s: jog stopped at %ld, finishing upwards", what, stepper.currentPosition());
+}
+
+// Polls run() until the motor stops, or a minute goes by
+template <class Stepper>
+static void runPolled(Stepper& stepper)
+{
+    unsigned long timeout = sim.now() + 60000000;
+    while (stepper.run() && sim.now() < timeout)
+	sim.advance(POLL_US);
+}
+
+// A jerk limited move must arrive without passing the target, without the speed changing
+// sign on the way, and with the acceleration only changing as fast as the jerk allows.
+// If retargetAt is set the target changes to retargetTo after that many steps, which must
+// still be blended smoothly, turning round once if the new target is already behind.
+static void testSCurve(long distance, float maxSpeed, float acceleration, float jerk,
+		       size_t retargetAt = 0, long retargetTo = 0)
+{
+    RecordingStepper stepper;
+    stepper.setMaxSpeed(maxSpeed);
+    stepper.setAcceleration(acceleration);
+    stepper.setJerk(jerk);
+    stepper.moveTo(distance);
+    long target = distance;
+    if (retargetAt)
+    {
+	unsigned long timeout = sim.now() + 60000000;
+	while (stepper.steps.size() < retargetAt && stepper.run() && sim.now() < timeout)
+	    sim.advance(POLL_US);
+	stepper.moveTo(retargetTo);
+	target = retargetTo;
+    }
+    runPolled(stepper);
+
+    // The speed is planned a step at a time, over 1 / speed rounded to whole microseconds, so the mean acceleration
+    // over each interval and how fast that changes come from the planned speeds without any of
+    // the jitter in when the steps were actually taken. The first step from rest, and the last
+    // ones once the speed is down to that of a single step from rest, creep rather than ramp.
+    const std::vector<Step>& steps = stepper.steps;
+    float creep = cbrtf(jerk / 6.0f) * 1.01f;
+    long furthest = 0;
+    int reversals = 0;
+    float worstJerk = 0.0, worstAccel = 0.0;
+    float lastAccel = 0.0, lastDt = 0.0;
+    for (size_t i = 0; i < steps.size(); i++)
+    {
+	furthest = max(furthest, steps[i].position);
+	if (i && (steps[i].speed < 0.0) != (steps[i - 1].speed < 0.0))
+	    reversals++;
+	if (!i || steps[i - 1].speed <= 0.0 || steps[i].speed <= creep)
+	{
+	    lastDt = 0.0;
+	    continue;
+	}
+	float dt = (unsigned long)(1000000.0 / steps[i - 1].speed + 0.5) / 1000000.0;
+	float accel = (steps[i].speed - steps[i - 1].speed) / dt;
+	// The speeds are floats, whose resolution limits how closely these can be told
+	float resolution = 2.0f * (nextafterf(steps[i].speed, INFINITY) - steps[i].speed) / dt;
+	worstAccel = max(worstAccel, (fabsf(accel) - resolution) / acceleration);
+	if (lastDt > 0.0)
+	    worstJerk = max(worstJerk, (fabsf(accel - lastAccel) - 2.0f * resolution) / (jerk * 0.5f * (dt + lastDt)));
+	lastAccel = accel;
+	lastDt = dt;
+    }
+    int turns = (retargetAt && retargetTo < (long)retargetAt) ? 1 : 0;
+    bool direct = !turns && furthest == target && steps.size() == (size_t)target;
+    check(stepper.currentPosition() == target && reversals == turns && (turns || direct)
+	  && worstJerk <= 1.01 && worstAccel <= 1.01,
+	  "s-curve %ld steps at %.0f/%.0f/%.0f, then %ld after %u: arrived at %ld, furthest %ld, %d reversals,"
+	  " jerk %.2f and acceleration %.2f of the limits",
+	  distance, maxSpeed, acceleration, jerk, target, (unsigned)retargetAt, stepper.currentPosition(), furthest,
+	  reversals, worstJerk, worstAccel);
+}
+
+// The interval the stepper planned before step i, or 0 if there is no such step
+static float planned(const std::vector<Step>& steps, size_t i)
+{
+    return (i < steps.size() && steps[i].speed) ? 1000000.0 / fabs(steps[i].speed) : 0.0;
+}
+
+// The fixed point ramp must make the same moves as the float one it replaced: the same steps,
+// with each interval the float ramp planned to within the microsecond the fixed point one
+// rounds it to. The intervals are the planned ones rather than the times the steps were
+// polled at. The float ramp keeps its interval in a float, and over thousands of steps that
+// rounding adds up to a few parts in 100000 and can move the start of its deceleration by a
+// step, so each interval is matched against the float one for that step or either neighbour.
+static void testFixedPoint(long distance, float maxSpeed, float acceleration)
+{
+    RecordingStepper fixed;
+    Recorder<FloatAccelStepper> reference;
+    fixed.setMaxSpeed(maxSpeed);
+    fixed.setAcceleration(acceleration);
+    fixed.moveTo(distance);
+    runPolled(fixed);
+    reference.setMaxSpeed(maxSpeed);
+    reference.setAcceleration(acceleration);
+    reference.moveTo(distance);
+    runPolled(reference);
+
+    const std::vector<Step>& a = fixed.steps;
+    const std::vector<Step>& b = reference.steps;
+    float worst = 0.0;
+    for (size_t i = 0; i < a.size() && i < b.size(); i++)
+    {
+	float closest = 1e9;
+	for (size_t j = i ? i - 1 : 0; j <= i + 1; j++)
+	    if (planned(b, j))
+		closest = min(closest, fabsf(planned(a, i) - planned(b, j)));
+	worst = max(worst, closest - planned(b, i) * 0.0001f);
+    }
+    check(fixed.currentPosition() == distance && a.size() == b.size() && worst <= 1.0,
+	  "fixed point %ld steps at %.0f/%.0f: %u steps against %u, intervals within %.2f us and 0.01%% of float",
+	  distance, maxSpeed, acceleration, (unsigned)a.size(), (unsigned)b.size(), worst);
+}
+
+// A ramp table only saves the working out, so a move must take the same steps at the same
+// times with it as without. The table holds each interval rounded to the microsecond, and
+// where the ramp runs off the end of a short one the live ramp carries on from that. The
+// deceleration replays the table backwards, where the live ramp runs Equation 13 down from
+// the cruise, and the two part by a few parts in 10000 by the last step. So each interval
+// must be within a microsecond and 0.05% of the one planned without the table.
+static void testRampTable(long distance, float maxSpeed, float acceleration, uint16_t size)
+{
+    RecordingStepper computed;
+    computed.setMaxSpeed(maxSpeed);
+    computed.setAcceleration(acceleration);
+    computed.moveTo(distance);
+    runPolled(computed);
+
+    std::vector<uint16_t> table(size);
+    RecordingStepper tabled;
+    tabled.setRampTable(&table[0], size);
+    tabled.setMaxSpeed(maxSpeed);
+    tabled.setAcceleration(acceleration);
+    tabled.moveTo(distance);
+    runPolled(tabled);
+
+    const std::vector<Step>& a = tabled.steps;
+    const std::vector<Step>& b = computed.steps;
+    float worst = 0.0;
+    for (size_t i = 0; i < a.size() && i < b.size(); i++)
+	worst = max(worst, fabsf(planned(a, i) - planned(b, i)) - planned(b, i) * 0.0005f);
+    check(tabled.currentPosition() == distance && a.size() == b.size() && worst <= 1.01,
+	  "ramp table of %u for %ld steps at %.0f/%.0f: %u steps against %u, intervals within %.2f us and 0.05%%",
+	  size, distance, maxSpeed, acceleration, (unsigned)a.size(), (unsigned)b.size(), worst);
+}
+
+// Targets queued behind the first must be run through in order. Where the legs carry on the
+// same way the motor must not slow down between them, so the whole run takes the same steps
+// as a single move to the last target, at the same intervals give or take a poll. Only where
+// the queue turns round may it stop, like a move to the target it turns at.
+static void testQueue(const long* targets, size_t count, float maxSpeed, float acceleration)
+{
+    RecordingStepper queued;
+    long queue[4];
+    queued.setQueue(queue, sizeof(queue) / sizeof(queue[0]));
+    queued.setMaxSpeed(maxSpeed);
+    queued.setAcceleration(acceleration);
+    for (size_t i = 0; i < count; i++)
+	queued.queueMoveTo(targets[i]);
+    long planned = queued.plannedDistanceToGo();
+    runPolled(queued);
+
+    // The same run as single moves, one to each target the queue turns round at and one to the last
+    RecordingStepper direct;
+    direct.setMaxSpeed(maxSpeed);
+    direct.setAcceleration(acceleration);
+    long firstStop = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+	long from = i ? targets[i - 1] : 0;
+	if (i + 1 == count || (targets[i + 1] > targets[i]) != (targets[i] > from))
+	{
+	    if (!firstStop)
+		firstStop = targets[i];
+	    direct.moveTo(targets[i]);
+	    runPolled(direct);
+	}
+    }
+
+    const std::vector<Step>& a = queued.steps;
+    const std::vector<Step>& b = direct.steps;
+    bool same = a.size() == b.size();
+    for (size_t i = 1; same && i < a.size(); i++)
+	same = a[i].position == b[i].position
+	    && labs((long)(a[i].time - a[i - 1].time) - (long)(b[i].time - b[i - 1].time)) <= POLL_US;
+    check(queued.currentPosition() == targets[count - 1] && queued.queueLength() == 0 && planned == firstStop && same,
+	  "queue of %u to %ld: planned %ld steps ahead, %u steps against %u as single moves, %s",
+	  (unsigned)count, targets[count - 1], planned, (unsigned)a.size(), (unsigned)b.size(),
+	  same ? "at the same times" : "at different times");
+}
+
+// An accelerated MultiStepper move must keep every stepper on the line from the start to the
+// targets, to within a step, and make the last step of each on the master's last step. The
+// third stepper is slower than the others, and holds the master back when its share of the
+// distance is large enough. The master's own max speed must be put back after.
+static void testMultiStepper(long x, long y, long z, float jerk)
+{
+    RecordingStepper steppers[3];
+    MultiStepper multi;
+    for (int i = 0; i < 3; i++)
+    {
+	steppers[i].setMaxSpeed(i == 2 ? 400 : 1000);
+	steppers[i].setAcceleration(500);
+	steppers[i].setJerk(jerk);
+	multi.addStepper(steppers[i]);
+    }
+    multi.setAccelerated(true);
+    long targets[3] = { x, y, z };
+    multi.moveTo(targets);
+
+    // The master is the one with the furthest to go
+    int master = 0;
+    for (int i = 1; i < 3; i++)
+	if (labs(targets[i]) > labs(targets[master]))
+	    master = i;
+    long masterSteps = labs(targets[master]);
+
+    float worst = 0.0;
+    unsigned long timeout = sim.now() + 60000000;
+    while (multi.run() && sim.now() < timeout)
+    {
+	float along = (float)steppers[master].currentPosition() / targets[master];
+	for (int i = 0; i < 3; i++)
+	    worst = max(worst, fabsf(steppers[i].currentPosition() - along * targets[i]));
+	sim.advance(POLL_US);
+    }
+
+    bool arrived = true, together = true;
+    unsigned long end = steppers[master].steps.back().time;
+    for (int i = 0; i < 3; i++)
+    {
+	arrived = arrived && steppers[i].currentPosition() == targets[i] && !steppers[i].isRunning();
+	together = together && (!targets[i] || steppers[i].steps.back().time == end);
+    }
+    unsigned long shortest = minInterval(steppers[master].steps);
+    float limit = min(1000.0f, 400.0f * masterSteps / labs(z));
+    check(arrived && together && worst < 1.0 && shortest >= 1000000 / limit - POLL_US
+	  && steppers[master].maxSpeed() == (master == 2 ? 400 : 1000),
+	  "multistepper to %ld,%ld,%ld with jerk %.0f: %s, %s, %.2f steps off the line at worst,"
+	  " master at %.0f steps/s at most against %.0f", x, y, z, jerk,
+	  arrived ? "arrived" : "not arrived", together ? "together" : "not together", worst,
+	  1000000.0 / shortest, limit);
+}
+
+int main()
+{
+    testTimerRestart();
+    testTimerCatchUp();
+    testScheduledStepping();
+
+    RecordingStepper polled;
+    testBacklashReversal("polled", polled, polled);
+    RecordingStepper timed;
+    StepTimer timer(timed);
+    timer.begin();
+    testBacklashReversal("timer", timed, timer);
+    RecordingStepper polledReset;
+    testBacklashReset("polled", polledReset, polledReset);
+    RecordingStepper timedReset;
+    StepTimer resetTimer(timedReset);
+    resetTimer.begin();
+    testBacklashReset("timer", timedReset, resetTimer);
+    RecordingStepper polledJog;
+    testJog("polled", polledJog, polledJog);
+    RecordingStepper timedJog;
+    StepTimer jogTimer(timedJog);
+    jogTimer.begin();
+    testJog("timer", timedJog, jogTimer);
+
+    static const long distances[] = { 3, 20, 200, 5000 };
+    static const float jerks[] = { 200, 2000, 20000 };
+    for (size_t d = 0; d < sizeof(distances) / sizeof(distances[0]); d++)
+	for (size_t j = 0; j < sizeof(jerks) / sizeof(jerks[0]); j++)
+	{
+	    testSCurve(distances[d], 1000, 500, jerks[j]);
+	    testSCurve(distances[d], 3000, 2000, jerks[j]);
+	}
+    testSCurve(2000, 1000, 500, 2000, 500, 4000);
+    testSCurve(2000, 1000, 500, 2000, 500, 200);
+    testSCurve(2000, 3000, 2000, 20000, 1800, 3000);
+
+    testFixedPoint(5, 1000, 500);
+    testFixedPoint(200, 1000, 500);
+    testFixedPoint(5000, 1000, 500);
+    testFixedPoint(5000, 3000, 2000);
+    testFixedPoint(20000, 4000, 100);
+
+    // Tables that hold the whole ramp, and ones it runs off the end of
+    testRampTable(200, 1000, 500, 1200);
+    testRampTable(5000, 1000, 500, 1200);
+    testRampTable(5000, 1000, 500, 64);
+    testRampTable(5000, 3000, 2000, 256);
+
+    // Legs that carry on at the cruise speed, legs too short to reach it, and a turn
+    static const long cruising[] = { 2000, 4000, 6000 };
+    testQueue(cruising, 3, 1000, 500);
+    static const long shortLegs[] = { 100, 250, 300, 600 };
+    testQueue(shortLegs, 4, 1000, 500);
+    static const long turning[] = { 2000, 3000, 1000, 500 };
+    testQueue(turning, 4, 1000, 500);
+
+    testMultiStepper(3000, 1000, -400, 0);
+    testMultiStepper(-500, 2000, 1200, 0);
+    testMultiStepper(3000, -1700, 600, 2000);
+
+    if (failures)
+	printf("%d checks failed\n", failures);
+    else
+	printf("all checks passed\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,151 @@
+// protobench.cpp
+//
+// Compares how many round trips a second a host gets out of the Moonlite sketch
+// with the ASCII protocol and with the binary one, by running the sketch in the
+// simulator against a client that sends each request as soon as the last
+// response is complete. This is what autofocus tools polling the position,
+// whether it is moving and the temperature are limited by.
+//
+// Usage: protobench [seconds]
+//
+// Times are virtual, so the results are the same on every host. The round trip
+// includes the time the sketch takes to notice and answer each request, with
+// the same loop and micros() costs as moonsim's defaults.
+
+#include "Sim.h"
+#include "SimOneWire.h"
+#include "../src/MoonliteBinary/MoonliteBinary.h"
+
+// From sketch.cpp
+void setup();
+void loop();
+extern const uint8_t simStepPin;
+extern const uint8_t simOneWirePin;
+
+static SimOneWireBus bus;
+static std::string received;
+
+// Runs the sketch until done() or a second goes by without it
+static void runUntil(std::function<bool()> done)
+{
+    unsigned long timeout = sim.now() + 1000000;
+    while (!done())
+    {
+	if (sim.now() > timeout)
+	{
+	    fprintf(stderr, "no response after \"%s\"\n", received.c_str());
+	    exit(1);
+	}
+	loop();
+	sim.advance(sim.loopCost);
+    }
+}
+
+// Sends an ASCII command and waits for its # terminated responses, all replies if it is a batch
+static void ascii(const char* commands, int responses)
+{
+    received.clear();
+    sim.sendSerial(sim.now(), commands);
+    runUntil([responses]() { return (int)std::count(received.begin(), received.end(), '#') >= responses; });
+}
+
+// Sends a binary request and waits for the status, which must be good
+static MoonliteStatus binary(uint8_t opcode, int32_t argument = 0)
+{
+    static uint8_t sequence = 0;
+    MoonliteRequest request = { opcode, ++sequence, argument };
+    uint8_t frame[MOONLITEBINARY_REQUEST_SIZE];
+    moonliteEncodeRequest(frame, request);
+    received.clear();
+    sim.sendSerial(sim.now(), frame, sizeof(frame));
+    runUntil([]() { return received.size() >= MOONLITEBINARY_RESPONSE_SIZE; });
+
+    MoonliteStatus status;
+    if (!moonliteDecodeStatus((const uint8_t*)received.data(), status) || status.sequence != sequence)
+    {
+	fprintf(stderr, "bad status for opcode %02X\n", opcode);
+	exit(1);
+    }
+    return status;
+}
+
+// Repeats poll for the given virtual time
+// \return polls a second
+static double rate(const char* what, unsigned long us, std::function<void()> poll)
+{
+    unsigned long start = sim.now();
+    unsigned long polls = 0;
+    while (sim.now() - start < us)
+    {
+	poll();
+	polls++;
+    }
+    double perSecond = polls * 1000000.0 / (sim.now() - start);
+    printf("%-42s %7.1f /s  %6.2f ms\n", what, perSecond, 1000.0 / perSecond);
+    return perSecond;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long us = (argc > 1 ? strtoul(argv[1], 0, 10) : 5) * 1000000;
+
+    bus.add(new SimDS18B20(0x1000, 20.0));
+    if (simOneWirePin != 0xff)
+	sim.attach(simOneWirePin, &bus);
+    sim.setStepPin(simStepPin);
+    sim.onTransmit([](uint8_t c) { received += (char)c; });
+    setup();
+    // Let the first temperature reading come in
+    while (sim.now() < 2000000)
+    {
+	loop();
+	sim.advance(sim.loopCost);
+    }
+
+    // What a poll of position, target, moving and temperature costs each way
+    double one = rate("ASCII :GP#", us, []() { ascii(":GP#", 1); });
+    double sequential = rate("ASCII :GP# :GN# :GI# :GT# one by one", us, []() {
+	ascii(":GP#", 1);
+	ascii(":GN#", 1);
+	ascii(":GI#", 1);
+	ascii(":GT#", 1);
+    });
+    double batched = rate("ASCII :GP#:GN#:GI#:GT# batched", us, []() { ascii(":GP#:GN#:GI#:GT#", 4); });
+
+    // With the speed as well, against the one command that returns all five
+    double five = rate("ASCII :GP# :GN# :GI# :GT# :GD# one by one", us, []() {
+	ascii(":GP#", 1);
+	ascii(":GN#", 1);
+	ascii(":GI#", 1);
+	ascii(":GT#", 1);
+	ascii(":GD#", 1);
+    });
+    double snapshot = rate("ASCII :XS#", us, []() { ascii(":XS#", 1); });
+    if (received.size() != 21)
+    {
+	fprintf(stderr, "bad :XS# response: \"%s\"\n", received.c_str());
+	return 1;
+    }
+
+    // The same baud rate first, to separate the framing from the speed
+    ascii(":XF2580#", 1);
+    double binarySlow = rate("binary status, 9600 baud", us, []() { binary(MOONLITEBINARY_STATUS); });
+    binary(MOONLITEBINARY_EXIT);
+
+    ascii(":XF#", 1);
+    double binaryFast = rate("binary status, 115200 baud", us, []() { binary(MOONLITEBINARY_STATUS); });
+    binary(MOONLITEBINARY_EXIT);
+
+    // Back in ASCII, it should still answer
+    ascii(":GV#", 1);
+    if (received != "10#")
+    {
+	fprintf(stderr, "no ASCII after the binary protocol: \"%s\"\n", received.c_str());
+	return 1;
+    }
+
+    printf("full status polls: binary %.1fx batched ASCII at 9600, %.1fx at 115200 (one by one ASCII %.1f/s, single :GP# %.1f/s)\n",
+	   binarySlow / batched, binaryFast / batched, sequential, one);
+    printf("status snapshot: :XS# %.1fx the five commands one by one\n", snapshot / five);
+    return 0;
+}
@@ -0,0 +1,71 @@
+// rampbench.cpp
+//
+// Compares what computeNewSpeed() costs per step with the fixed point ramp the
+// AVR build uses and with the float one it replaced, on the host.
+//
+// Usage: rampbench [moves]
+//
+// Each step is taken with runFromTimer(), which is computeNewSpeed() plus a
+// position update and a micros() read, through a step() that does nothing, so
+// the pins do not dominate. Host timings only show the relative cost; on the
+// AVR, which has no FPU, a float divide costs several times an integer one.
+
+#include <chrono>
+#include "Sim.h"
+#include "../src/AccelStepper/AccelStepper.h"
+#include "FloatAccelStepper.h"
+
+// A stepper with no pins, which steps as fast as runFromTimer() is called
+template <class Stepper>
+class Bench : public Stepper
+{
+public:
+    Bench()
+	: Stepper(Stepper::DRIVER, 40, 41)
+    {
+    }
+
+protected:
+    virtual void step(long)
+    {
+    }
+};
+
+// Runs moves back and forth with each ramp profile, and prints the time per step
+template <class Stepper>
+static double bench(const char* what, unsigned long moves, long distance, float maxSpeed, float acceleration)
+{
+    Bench<Stepper> stepper;
+    stepper.setMaxSpeed(maxSpeed);
+    stepper.setAcceleration(acceleration);
+    unsigned long steps = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned long m = 0; m < moves; m++)
+    {
+	stepper.moveTo((m & 1) ? 0 : distance);
+	while (stepper.runFromTimer())
+	    steps++;
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / steps;
+    printf("%-8s %5ld steps at %4.0f/%4.0f %8.1f ns a step\n", what, distance, maxSpeed, acceleration, ns);
+    return ns;
+}
+
+// Both ramps on the same moves
+static void compare(unsigned long moves, long distance, float maxSpeed, float acceleration)
+{
+    double fixed = bench<AccelStepper>("fixed", moves, distance, maxSpeed, acceleration);
+    double reference = bench<FloatAccelStepper>("float", moves, distance, maxSpeed, acceleration);
+    printf("%-8s %38.2fx\n", "ratio", reference / fixed);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long moves = argc > 1 ? strtoul(argv[1], 0, 10) : 2000;
+
+    // A short move is all ramp, a long one mostly cruise at cmin
+    compare(moves, 200, 1000, 500);
+    compare(moves / 10, 5000, 1000, 500);
+    compare(moves / 10, 5000, 3000, 2000);
+    return 0;
+}
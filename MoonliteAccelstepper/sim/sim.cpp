@@ -0,0 +1,198 @@
+// sim.cpp
+//
+// Runs the Moonlite sketch on the host against a simulated clock, serial line
+// and DS18B20, so its timing can be measured and compared without hardware.
+//
+// Usage: moonsim [options] [script]
+//   -t ms        Run for this long (default: until the script ends, or 10000)
+//   -e file      Write the step/direction pin edges as time_us,pin,level
+//   -q           No serial transcript on stdout
+//   -l us        Cost charged for each loop() (default 10)
+//   -m us        Cost charged for each micros() or millis() call (default 4)
+//   -n count     Number of DS18B20s on the 1-Wire bus (default 1)
+//   -T celsius   Initial temperature (default 20)
+//   -s serial    Serial number of the first DS18B20, the others follow on (default 0x1000)
+//   -E file      Load the EEPROM from file if it exists, and save it back at the end, to
+//                carry it over from one run to the next like a reset of the real thing
+//
+// Script lines, times in milliseconds from reset:
+//   <time> send <text>          Serial input, sent at the configured baud rate
+//   <time> temp <celsius> [n]   Temperature of sensor n (default 0) from then on
+//   <time> end                  Stop the run
+//   // comment
+//
+// The host has 32 bit ints and 64 bit doubles where the AVR has 16 and 32, so
+// arithmetic that overflows on the AVR may not here. AccelStepper is built with
+// ACCELSTEPPER_FIXED_POINT to match the AVR ramp.
+
+#include <unistd.h>
+#include "Sim.h"
+#include "SimOneWire.h"
+
+// From sketch.cpp
+void setup();
+void loop();
+extern const uint8_t simStepPin;
+extern const uint8_t simOneWirePin;
+long simPosition();
+
+static SimOneWireBus bus;
+
+static void usage()
+{
+    fprintf(stderr, "usage: moonsim [-t ms] [-e edges.csv] [-q] [-l us] [-m us] [-n sensors] [-T celsius] [-s serial] [-E eeprom] [script]\n");
+    exit(2);
+}
+
+// Reads the script, scheduling its events. Returns the end time in microseconds, or 0 if there is no end line.
+static unsigned long loadScript(const char* path, unsigned long* last)
+{
+    FILE* f = fopen(path, "r");
+    if (!f)
+    {
+	perror(path);
+	exit(1);
+    }
+
+    char line[256];
+    unsigned long end = 0;
+    int lineNo = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+	lineNo++;
+	line[strcspn(line, "\r\n")] = 0;
+	char* p = line + strspn(line, " \t");
+	if (!*p || !strncmp(p, "//", 2))
+	    continue;
+
+	char* rest;
+	unsigned long time = (unsigned long)(strtod(p, &rest) * 1000.0);
+	char what[16];
+	int used = 0;
+	if (rest == p || sscanf(rest, " %15s %n", what, &used) < 1)
+	{
+	    fprintf(stderr, "%s:%d: expected <time ms> <send|temp|end>\n", path, lineNo);
+	    exit(1);
+	}
+	rest += used;
+	*last = max(*last, time);
+
+	if (!strcmp(what, "send"))
+	    sim.sendSerial(time, rest);
+	else if (!strcmp(what, "temp"))
+	{
+	    float celsius = 0;
+	    int sensor = 0;
+	    if (sscanf(rest, "%f %d", &celsius, &sensor) < 1 || sensor < 0 || sensor >= bus.count())
+	    {
+		fprintf(stderr, "%s:%d: expected temp <celsius> [sensor]\n", path, lineNo);
+		exit(1);
+	    }
+	    SimDS18B20* device = bus.device(sensor);
+	    sim.at(time, [device, celsius]() { device->setTemperature(celsius); });
+	}
+	else if (!strcmp(what, "end"))
+	    end = time;
+	else
+	{
+	    fprintf(stderr, "%s:%d: unknown event %s\n", path, lineNo, what);
+	    exit(1);
+	}
+    }
+    fclose(f);
+    return end;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long runTime = 0;
+    const char* edgesPath = 0;
+    bool quiet = false;
+    int sensors = 1;
+    float celsius = 20.0;
+    uint32_t serial = 0x1000;
+    const char* eepromPath = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:e:ql:m:n:T:s:E:")) != -1)
+    {
+	switch (opt)
+	{
+	    case 't': runTime = strtoul(optarg, 0, 10) * 1000; break;
+	    case 'e': edgesPath = optarg; break;
+	    case 'q': quiet = true; break;
+	    case 'l': sim.loopCost = strtoul(optarg, 0, 10); break;
+	    case 'm': sim.microsCost = strtoul(optarg, 0, 10); break;
+	    case 'n': sensors = atoi(optarg); break;
+	    case 'T': celsius = atof(optarg); break;
+	    case 's': serial = strtoul(optarg, 0, 0); break;
+	    case 'E': eepromPath = optarg; break;
+	    default: usage();
+	}
+    }
+    if (argc - optind > 1)
+	usage();
+
+    for (int i = 0; i < sensors; i++)
+	bus.add(new SimDS18B20(serial + i, celsius));
+    if (simOneWirePin != 0xff)
+	sim.attach(simOneWirePin, &bus);
+    sim.setStepPin(simStepPin);
+    if (!quiet)
+	sim.recordSerial(stdout);
+
+    FILE* edges = 0;
+    if (edgesPath)
+    {
+	edges = fopen(edgesPath, "w");
+	if (!edges)
+	{
+	    perror(edgesPath);
+	    return 1;
+	}
+	fprintf(edges, "time_us,pin,level\n");
+	sim.recordEdges(edges);
+    }
+
+    if (eepromPath && !sim.loadEeprom(eepromPath))
+    {
+	fprintf(stderr, "%s: not an EEPROM image\n", eepromPath);
+	return 1;
+    }
+
+    unsigned long last = 0;
+    if (optind < argc)
+    {
+	unsigned long end = loadScript(argv[optind], &last);
+	if (!runTime)
+	    runTime = end;
+    }
+    if (!runTime)
+	runTime = last ? last + 1000000 : 10000000;
+
+    setup();
+    unsigned long loops = 0;
+    while (sim.now() < runTime)
+    {
+	loop();
+	sim.advance(sim.loopCost);
+	loops++;
+    }
+
+    sim.report(stdout);
+    printf("loops %lu, mean %.1f us\n", loops, (double)sim.now() / loops);
+    printf("position %ld\n", simPosition());
+    unsigned long conversions = 0;
+    for (uint8_t i = 0; i < bus.count(); i++)
+	conversions += bus.device(i)->conversions();
+    printf("1-wire resets %lu, slots %lu, conversions %lu\n", bus.resets(), bus.slots(), conversions);
+
+    if (edges)
+	fclose(edges);
+    if (eepromPath && !sim.saveEeprom(eepromPath))
+    {
+	perror(eepromPath);
+	return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,32 @@
+// sketch.cpp
+//
+// Builds MoonliteAccelstepper.ino as C++ for the host. The Arduino IDE generates
+// prototypes for the sketch's functions, so the ones used before they are defined
+// are declared here instead.
+
+#include "Arduino.h"
+
+void dispatch(const char *cmd, char *param);
+#include "../src/MoonliteBinary/MoonliteBinary.h"
+void readBinary();
+void endBinary();
+void dispatchBinary(const MoonliteRequest &request);
+void loadSettings();
+void applySettings();
+
+#include "../MoonliteAccelstepper.ino"
+
+// What the simulator needs to know about the sketch's configuration
+
+extern const uint8_t simStepPin = STEP_PIN;
+
+#ifdef ONE_WIRE_BUS
+extern const uint8_t simOneWirePin = ONE_WIRE_BUS;
+#else
+extern const uint8_t simOneWirePin = 0xff;
+#endif
+
+long simPosition()
+{
+  return motor.currentPosition();
+}
@@ -35,6 +35,75 @@ void AccelStepper::move(long relative)
     moveTo(_currentPos + relative);
 }
 
+void AccelStepper::setQueue(long* queue, uint8_t size)
+{
+    _queue = queue;
+    _queueSize = queue ? size : 0;
+    _queueHead = 0;
+    _queueCount = 0;
+}
+
+boolean AccelStepper::queueMoveTo(long absolute)
+{
+    if (!_queueCount && _currentPos == _targetPos)
+    {
+	// Nothing to follow, so just go
+	moveTo(absolute);
+	return true;
+    }
+    if (_queueCount >= _queueSize)
+	return false;
+    uint8_t tail = _queueHead + _queueCount;
+    if (tail >= _queueSize)
+	tail -= _queueSize;
+    _queue[tail] = absolute;
+    _queueCount++;
+    return true;
+}
+
+boolean AccelStepper::queueMove(long relative)
+{
+    return queueMoveTo(queueEndPosition() + relative);
+}
+
+uint8_t AccelStepper::queueLength()
+{
+    return _queueCount;
+}
+
+long AccelStepper::queueEndPosition()
+{
+    if (!_queueCount)
+	return _targetPos;
+    uint8_t last = _queueHead + _queueCount - 1;
+    if (last >= _queueSize)
+	last -= _queueSize;
+    return _queue[last];
+}
+
+void AccelStepper::clearQueue()
+{
+    _queueCount = 0;
+}
+
+long AccelStepper::plannedDistanceToGo()
+{
+    long distanceTo = _targetPos - _currentPos;
+    long from = _targetPos;
+    uint8_t i = _queueHead;
+    for (uint8_t n = 0; n < _queueCount; n++)
+    {
+	long to = _queue[i];
+	if ((distanceTo > 0 && to < from) || (distanceTo < 0 && to > from))
+	    break; // Reverses here, so need to stop at from
+	distanceTo += to - from;
+	from = to;
+	if (++i >= _queueSize)
+	    i = 0;
+    }
+    return distanceTo;
+}
+
 // Implements steps according to the current step interval
 // You must call this at least once per step
 // returns true if a step occurred
@@ -59,7 +128,20 @@ boolean AccelStepper::runSpeed()
 	}
 	step(_currentPos);
 
-	_lastStepTime = time; // Caution: does not account for costs in step()
+	if (_scheduleRestart)
+	{
+	    // First step since stopping, start a new schedule from now
+	    _lastStepTime = time;
+	    _scheduleRestart = false;
+	    return true;
+	}
+
+	if (recordLateness(time - _lastStepTime - _stepInterval))
+	    _lastStepTime = time; // Too far behind to catch up without exceeding the speed, drop the missed steps
+	else if (_scheduledStepping)
+	    _lastStepTime += _stepInterval; // Keep to the schedule, the next step makes up the lateness
+	else
+	    _lastStepTime = time; // Caution: does not account for costs in step()
 
 	return true;
     }
@@ -69,6 +151,66 @@ boolean AccelStepper::runSpeed()
     }
 }
 
+// Counts a step taken late microseconds after it was due in the step statistics
+// returns true if it is a whole interval or more late, too late to catch up
+boolean AccelStepper::recordLateness(unsigned long late)
+{
+    if (late > _maxLateness)
+	_maxLateness = late;
+    if (late >= (_stepInterval >> 3))
+	_lateSteps++;
+    if (_histogram)
+    {
+	uint8_t bucket = 0;
+	for (unsigned long l = late; l && bucket < _histogramSize - 1; l >>= 1)
+	    bucket++;
+	if (_histogram[bucket] == 0xffff)
+	    for (uint8_t i = 0; i < _histogramSize; i++)
+		_histogram[i] >>= 1;
+	_histogram[bucket]++;
+    }
+    if (late >= _stepInterval)
+    {
+	_missedSteps += late / _stepInterval;
+	return true;
+    }
+    return false;
+}
+
+// Implements one step of an interrupt driven move
+// Call this from a timer ISR, and reload the timer with the returned interval
+// returns 0 when the motor has stopped
+unsigned long AccelStepper::runFromTimer(unsigned long late)
+{
+    if (!_stepInterval)
+	return 0;
+
+    if (_direction == DIRECTION_CW)
+	_currentPos += 1;
+    else
+	_currentPos -= 1;
+    step(_currentPos);
+
+    // Kept so the first step of the next move waits out its interval, see nextStepDelay()
+    _lastStepTime = micros();
+    if (_scheduleRestart)
+	_scheduleRestart = false; // Idle time is not lateness
+    else
+	recordLateness(late);
+
+    computeNewSpeed();
+    return _stepInterval;
+}
+
+// The time until runSpeed() would take the next step, counted from the last one
+unsigned long AccelStepper::nextStepDelay()
+{
+    if (!_stepInterval)
+	return 0;
+    unsigned long since = micros() - _lastStepTime;
+    return (since < _stepInterval) ? _stepInterval - since : 0;
+}
+
 long AccelStepper::distanceToGo()
 {
     return _targetPos - _currentPos;
@@ -92,13 +234,39 @@ void AccelStepper::setCurrentPosition(long position)
     _n = 0;
     _stepInterval = 0;
     _speed = 0.0;
+    _scurveAccel = 0.0;
+    _scurvePos = position;
+    _scurveCreep = false;
+    _queueCount = 0;
 }
 
 void AccelStepper::computeNewSpeed()
 {
-    long distanceTo = distanceToGo(); // +ve is clockwise from curent location
+    // Carry straight on to the next queued segment on reaching this one's target
+    while (_queueCount && _currentPos == _targetPos)
+    {
+	_targetPos = _queue[_queueHead];
+	if (++_queueHead >= _queueSize)
+	    _queueHead = 0;
+	_queueCount--;
+    }
 
+    if (_jerk != 0.0)
+    {
+	computeNewSpeedSCurve();
+	return;
+    }
+
+    long distanceTo = plannedDistanceToGo(); // +ve is clockwise from curent location
+
+#if ACCELSTEPPER_FIXED_POINT
+    // While decelerating -_n is the number of steps left. While accelerating, Equation 16 on the
+    // speed of the last step planned comes to _n - 1: that speed is the ramp's speed half way
+    // through the step, and the float ramp rounds the result down.
+    long stepsToStop = (_n <= 0) ? -_n : min(_n - 1, _nmax);
+#else
     long stepsToStop = (long)((_speed * _speed) / (2.0 * _acceleration)); // Equation 16
+#endif
 
     if (distanceTo == 0 && stepsToStop <= 1)
     {
@@ -144,13 +312,53 @@ void AccelStepper::computeNewSpeed()
 	}
     }
 
+    // Accelerating with _n steps taken replays the ramp table forwards, decelerating with
+    // -_n steps to go replays it backwards
+    long rampIndex = (_n < 0) ? -_n - 1 : _n;
+
     // Need to accelerate or decelerate
+#if ACCELSTEPPER_FIXED_POINT
     if (_n == 0)
     {
 	// First step from stopped
+	_scheduleRestart = true;
+	_cnq = _c0q;
+	_direction = (distanceTo > 0) ? DIRECTION_CW : DIRECTION_CCW;
+    }
+    else if (rampIndex < _rampLen)
+    {
+	// Precomputed Equation 13
+	_cnq = (long)_rampTable[rampIndex] << 8;
+    }
+    else
+    {
+	// Subsequent step. Works for accel (n is +_ve) and decel (n is -ve).
+	// The divide is rounded to nearest, since truncating it errs the same way on
+	// every step and a long ramp drifts by microseconds from the float one.
+	long d = (4 * _n) + 1;
+	long q = (2 * _cnq) / d;
+	if (2 * ((2 * _cnq) % d) >= labs(d))
+	    q += (d > 0) ? 1 : -1;
+	_cnq = _cnq - q; // Equation 13
+	_cnq = constrain(_cnq, _cminq, 0x3fffffffL);
+    }
+    _n++;
+    _stepInterval = (_cnq + 128) >> 8;
+    // Only the sign, speed() works out the magnitude
+    _speed = (_direction == DIRECTION_CW) ? 1.0 : -1.0;
+#else
+    if (_n == 0)
+    {
+	// First step from stopped
+	_scheduleRestart = true;
 	_cn = _c0;
 	_direction = (distanceTo > 0) ? DIRECTION_CW : DIRECTION_CCW;
     }
+    else if (rampIndex < _rampLen)
+    {
+	// Precomputed Equation 13
+	_cn = _rampTable[rampIndex];
+    }
     else
     {
 	// Subsequent step. Works for accel (n is +_ve) and decel (n is -ve).
@@ -162,6 +370,7 @@ void AccelStepper::computeNewSpeed()
     _speed = 1000000.0 / _cn;
     if (_direction == DIRECTION_CCW)
 	_speed = -_speed;
+#endif
 
 #if 0
     Serial.println(_speed);
@@ -176,6 +385,205 @@ void AccelStepper::computeNewSpeed()
 #endif
 }
 
+// Jerk limited version of computeNewSpeed()
+// _speed and _scurveAccel are the speed and acceleration at the time of the last step,
+// and are integrated over the step interval assuming constant jerk
+void AccelStepper::computeNewSpeedSCurve()
+{
+    long distanceTo = plannedDistanceToGo(); // +ve is clockwise from curent location
+
+    if (_currentPos == _scurvePos)
+    {
+	// Called for a new target or parameters rather than after a step. Only a
+	// start from rest needs handling now, otherwise the next step picks it up.
+	if (_stepInterval != 0)
+	    return;
+	if (distanceTo == 0)
+	    return;
+	startSCurve(distanceTo);
+	return;
+    }
+    _scurvePos = _currentPos;
+
+    if (_scurveCreep)
+    {
+	// Too short for the S-curve, keep the speed of the first step
+	if (distanceTo == 0)
+	{
+	    _stepInterval = 0;
+	    _speed = 0.0;
+	    _scurveCreep = false;
+	}
+	else if ((distanceTo > 0) != (_direction == DIRECTION_CW))
+	    startSCurve(distanceTo);
+	return;
+    }
+
+    // Work in the current direction of travel, so speed is +ve and
+    // ahead is -ve if the target is behind us
+    float speed = fabs(_speed);
+    float accel = (_direction == DIRECTION_CW) ? _scurveAccel : -_scurveAccel;
+    long ahead = (_direction == DIRECTION_CW) ? distanceTo : -distanceTo;
+    long stepsToStop = scurveStepsToStop(speed, accel);
+
+    if (distanceTo == 0 && stepsToStop <= 1)
+    {
+	// We are at the target and its time to stop
+	_stepInterval = 0;
+	_speed = 0.0;
+	_scurveAccel = 0.0;
+	return;
+    }
+
+    // Steps are the only chance to change the acceleration, so look one step ahead
+    // and start decelerating now if carrying on accelerating would leave too little room
+    if (accel >= 0.0)
+    {
+	float dt = 1.0 / speed;
+	long stepsToStopNext = scurveStepsToStop(speed + (accel + 0.5 * _jerk * dt) * dt, accel + _jerk * dt);
+	stepsToStop = max(stepsToStop, stepsToStopNext);
+    }
+
+    // Pick the acceleration we want, then move towards it no faster than _jerk allows
+    float wanted;
+    if (ahead - 2 <= stepsToStop)
+    {
+	// Need to decelerate. Once the speed left is what ramping the deceleration
+	// out to zero will take off, do that so both reach zero together.
+	if (accel < 0.0 && speed <= (accel * accel) / (2.0 * _jerk))
+	    wanted = 0.0;
+	else
+	    wanted = -_acceleration;
+    }
+    else if (accel < 0.0 && speed <= _maxSpeed && ahead - 2 <= scurveStepsToStop(speed, 0.0))
+    {
+	// Decelerating to the target and ahead of schedule, ease off
+	float decel = (speed * speed) / (2.0 * ahead);
+	wanted = -min(_acceleration, decel);
+    }
+    else
+    {
+	// Accelerate or decelerate towards max speed, ramping the acceleration
+	// down in time to arrive there with zero acceleration
+	float dv = _maxSpeed - speed;
+	wanted = min(_acceleration, (float)sqrt(2.0 * _jerk * fabs(dv)));
+	if (dv < 0.0)
+	    wanted = -wanted;
+    }
+
+    float dt = _stepInterval / 1000000.0;
+    float maxChange = _jerk * dt;
+    float lastAccel = accel;
+    accel += constrain(wanted - accel, -maxChange, maxChange);
+    speed += (lastAccel + accel) * 0.5 * dt;
+
+    if (speed <= 0.0)
+    {
+	// Came to rest between steps, so start again from rest towards the target
+	if (distanceTo == 0)
+	{
+	    _stepInterval = 0;
+	    _speed = 0.0;
+	    _scurveAccel = 0.0;
+	    return;
+	}
+	startSCurve(distanceTo);
+	return;
+    }
+
+    // Rounded, since truncating makes every step early and the stop overshoots on long moves
+    _stepInterval = 1000000.0 / speed + 0.5;
+    _speed = (_direction == DIRECTION_CW) ? speed : -speed;
+    _scurveAccel = (_direction == DIRECTION_CW) ? accel : -accel;
+}
+
+// First step of a jerk limited move from rest, x = jerk * t^3 / 6
+// Moves too short to ramp up and down again between steps creep at that speed instead
+void AccelStepper::startSCurve(long distanceTo)
+{
+    float t = pow(6.0 / _jerk, 1.0 / 3.0);
+    _direction = (distanceTo > 0) ? DIRECTION_CW : DIRECTION_CCW;
+    _scheduleRestart = true;
+    _scurveAccel = 0.0;
+    _scurvePos = _currentPos;
+    _stepInterval = t * 1000000.0;
+    _scurveCreep = scurveStepsToStop(_jerk * t * t * 0.5, _jerk * t) >= labs(distanceTo) - 1;
+    if (_scurveCreep)
+	_speed = (distanceTo > 0) ? 1.0 / t : -1.0 / t;
+    else
+	_speed = 0.0;
+}
+
+// Steps needed to stop from speed and accel, ramping the deceleration in and out at _jerk
+long AccelStepper::scurveStepsToStop(float speed, float accel)
+{
+    float steps = 0.0;
+    if (accel < 0.0)
+    {
+	// Already decelerating, carry on at that rate then ramp out
+	accel = -accel;
+	return (long)((speed * speed) / (2.0 * accel) + (accel * accel * accel) / (24.0 * _jerk * _jerk));
+    }
+    if (accel > 0.0)
+    {
+	// Still accelerating, ramp that down to zero first
+	float t = accel / _jerk;
+	steps = speed * t + accel * t * t * 0.5 - _jerk * t * t * t / 6.0;
+	speed += (accel * accel) / (2.0 * _jerk);
+    }
+
+    float rampSpeed = (_acceleration * _acceleration) / _jerk; // Speed lost ramping to full decel and back
+    if (speed < rampSpeed)
+	return (long)(steps + speed * sqrt(speed / _jerk));
+    return (long)(steps + (speed * speed) / (2.0 * _acceleration) + (speed * _acceleration) / (2.0 * _jerk));
+}
+
+void AccelStepper::setScheduledStepping(bool scheduled)
+{
+    _scheduledStepping = scheduled;
+}
+
+unsigned long AccelStepper::lateSteps()
+{
+    return _lateSteps;
+}
+
+unsigned long AccelStepper::missedSteps()
+{
+    return _missedSteps;
+}
+
+unsigned long AccelStepper::maxLateness()
+{
+    return _maxLateness;
+}
+
+void AccelStepper::resetStepStats()
+{
+    _lateSteps = 0;
+    _missedSteps = 0;
+    _maxLateness = 0;
+    if (_histogram)
+	memset(_histogram, 0, _histogramSize * sizeof(uint16_t));
+}
+
+void AccelStepper::setLatenessHistogram(uint16_t* buckets, uint8_t count)
+{
+    _histogram = count ? buckets : 0;
+    _histogramSize = count;
+    resetStepStats();
+}
+
+void AccelStepper::setJerk(float jerk)
+{
+    if (jerk < 0.0)
+	jerk = -jerk;
+    _jerk = jerk;
+    _scurveAccel = 0.0;
+    _scurvePos = _currentPos;
+    _scurveCreep = false;
+}
+
 // Run the motor to implement speed and acceleration in order to proceed to the target position
 // You must call this at least once per step, preferably in your main loop
 // If the motor is in the desired position, the cost is very small
@@ -200,6 +608,13 @@ AccelStepper::AccelStepper(uint8_t interface, uint8_t pin1, uint8_t pin2, uint8_
     _minPulseWidth = 1;
     _enablePin = 0xff;
     _lastStepTime = 0;
+    _scheduledStepping = false;
+    _scheduleRestart = true;
+    _lateSteps = 0;
+    _missedSteps = 0;
+    _maxLateness = 0;
+    _histogram = 0;
+    _histogramSize = 0;
     _pin[0] = pin1;
     _pin[1] = pin2;
     _pin[2] = pin3;
@@ -211,6 +626,23 @@ AccelStepper::AccelStepper(uint8_t interface, uint8_t pin1, uint8_t pin2, uint8_
     _c0 = 0.0;
     _cn = 0.0;
     _cmin = 1.0;
+    _jerk = 0.0;
+    _scurveAccel = 0.0;
+    _scurvePos = 0;
+    _scurveCreep = false;
+    _rampTable = 0;
+    _rampSize = 0;
+    _rampLen = 0;
+    _queue = 0;
+    _queueSize = 0;
+    _queueHead = 0;
+    _queueCount = 0;
+#if ACCELSTEPPER_FIXED_POINT
+    _c0q = 0;
+    _cnq = 0;
+    _cminq = 256;
+    _nmax = 0;
+#endif
     _direction = DIRECTION_CCW;
 
     int i;
@@ -235,6 +667,13 @@ AccelStepper::AccelStepper(void (*forward)(), void (*backward)())
     _minPulseWidth = 1;
     _enablePin = 0xff;
     _lastStepTime = 0;
+    _scheduledStepping = false;
+    _scheduleRestart = true;
+    _lateSteps = 0;
+    _missedSteps = 0;
+    _maxLateness = 0;
+    _histogram = 0;
+    _histogramSize = 0;
     _pin[0] = 0;
     _pin[1] = 0;
     _pin[2] = 0;
@@ -247,6 +686,23 @@ AccelStepper::AccelStepper(void (*forward)(), void (*backward)())
     _c0 = 0.0;
     _cn = 0.0;
     _cmin = 1.0;
+    _jerk = 0.0;
+    _scurveAccel = 0.0;
+    _scurvePos = 0;
+    _scurveCreep = false;
+    _rampTable = 0;
+    _rampSize = 0;
+    _rampLen = 0;
+    _queue = 0;
+    _queueSize = 0;
+    _queueHead = 0;
+    _queueCount = 0;
+#if ACCELSTEPPER_FIXED_POINT
+    _c0q = 0;
+    _cnq = 0;
+    _cminq = 256;
+    _nmax = 0;
+#endif
     _direction = DIRECTION_CCW;
 
     int i;
@@ -256,28 +712,76 @@ AccelStepper::AccelStepper(void (*forward)(), void (*backward)())
     setAcceleration(1);
 }
 
+#if ACCELSTEPPER_FIXED_POINT
+// Convert microseconds to 1/256 microseconds, limited so Equation 13 cannot overflow
+long AccelStepper::toFixed(float us)
+{
+    if (us >= (0x3fffffffL / 256))
+	return 0x3fffffffL;
+    return (long)(us * 256.0);
+}
+#endif
+
 void AccelStepper::setMaxSpeed(float speed)
 {
     if (speed < 0.0)
        speed = -speed;
     if (_maxSpeed != speed)
     {
+	float currentSpeed = this->speed();
 	_maxSpeed = speed;
 	_cmin = 1000000.0 / speed;
+#if ACCELSTEPPER_FIXED_POINT
+	_cminq = toFixed(_cmin);
+	_nmax = (long)((speed * speed) / (2.0 * _acceleration)); // Equation 16
+#endif
+	buildRampTable();
 	// Recompute _n from current speed and adjust speed if accelerating or cruising
 	if (_n > 0)
 	{
-	    _n = (long)((_speed * _speed) / (2.0 * _acceleration)); // Equation 16
+	    _n = (long)((currentSpeed * currentSpeed) / (2.0 * _acceleration)); // Equation 16
 	    computeNewSpeed();
 	}
     }
 }
 
+void AccelStepper::setRampTable(uint16_t* table, uint16_t size)
+{
+    _rampTable = table;
+    _rampSize = table ? size : 0;
+    buildRampTable();
+}
+
+// Run Equation 13 from c0 until max speed is reached or the table is full
+// Called whenever c0 or cmin changes
+void AccelStepper::buildRampTable()
+{
+    _rampLen = 0;
+    // Intervals are stored as 16 bits
+    if (_c0 > 65535.0)
+	return;
+
+    float cn = _c0;
+    while (_rampLen < _rampSize)
+    {
+	_rampTable[_rampLen++] = (uint16_t)(cn + 0.5);
+	if (cn <= _cmin)
+	    break; // Cruising from here on
+	cn = cn - ((2.0 * cn) / ((4.0 * _rampLen) + 1)); // Equation 13
+	cn = max(cn, _cmin);
+    }
+}
+
 float   AccelStepper::maxSpeed()
 {
     return _maxSpeed;
 }
 
+float   AccelStepper::acceleration()
+{
+    return _acceleration;
+}
+
 void AccelStepper::setAcceleration(float acceleration)
 {
     if (acceleration == 0.0)
@@ -291,19 +795,26 @@ void AccelStepper::setAcceleration(float acceleration)
 	// New c0 per Equation 7, with correction per Equation 15
 	_c0 = 0.676 * sqrt(2.0 / acceleration) * 1000000.0; // Equation 15
 	_acceleration = acceleration;
+#if ACCELSTEPPER_FIXED_POINT
+	_c0q = toFixed(_c0);
+	_nmax = (long)((_maxSpeed * _maxSpeed) / (2.0 * _acceleration)); // Equation 16
+#endif
+	buildRampTable();
 	computeNewSpeed();
     }
 }
 
 void AccelStepper::setSpeed(float speed)
 {
-    if (speed == _speed)
+    if (speed == this->speed())
         return;
     speed = constrain(speed, -_maxSpeed, _maxSpeed);
     if (speed == 0.0)
 	_stepInterval = 0;
     else
     {
+	if (!_stepInterval)
+	    _scheduleRestart = true;
 	_stepInterval = fabs(1000000.0 / speed);
 	_direction = (speed > 0.0) ? DIRECTION_CW : DIRECTION_CCW;
     }
@@ -312,7 +823,16 @@ void AccelStepper::setSpeed(float speed)
 
 float AccelStepper::speed()
 {
+#if ACCELSTEPPER_FIXED_POINT
+    if (_jerk != 0.0)
+	return _speed;
+    if (!_stepInterval)
+	return 0.0;
+    float speed = 1000000.0 / _stepInterval;
+    return (_direction == DIRECTION_CW) ? speed : -speed;
+#else
     return _speed;
+#endif
 }
 
 // Subclasses can override
@@ -636,10 +1156,16 @@ void AccelStepper::runToNewPosition(long position)
 
 void AccelStepper::stop()
 {
-    if (_speed != 0.0)
+    _queueCount = 0;
+    float speed = this->speed();
+    if (speed != 0.0)
     {    
-	long stepsToStop = (long)((_speed * _speed) / (2.0 * _acceleration)) + 1; // Equation 16 (+integer rounding)
-	if (_speed > 0)
+	long stepsToStop;
+	if (_jerk != 0.0)
+	    stepsToStop = scurveStepsToStop(fabs(speed), (speed > 0) ? _scurveAccel : -_scurveAccel) + 1;
+	else
+	    stepsToStop = (long)((speed * speed) / (2.0 * _acceleration)) + 1; // Equation 16 (+integer rounding)
+	if (speed > 0)
 	    move(stepsToStop);
 	else
 	    move(-stepsToStop);
@@ -650,3 +1176,10 @@ bool AccelStepper::isRunning()
 {
     return !(_speed == 0.0 && _targetPos == _currentPos);
 }
+
+void AccelStepper::stepOnce(boolean clockwise)
+{
+    _direction = clockwise ? DIRECTION_CW : DIRECTION_CCW;
+    _currentPos += clockwise ? 1 : -1;
+    step(_currentPos);
+}
@@ -268,6 +268,18 @@
 // These defs cause trouble on some versions of Arduino
 #undef round
 
+// Compute the acceleration ramp with fixed point integer arithmetic instead of
+// floating point. Each float divide costs tens of microseconds on 8 bit AVRs, and
+// computeNewSpeed() runs after every step. Defaults to on for AVR only.
+// The fixed point ramp limits the slowest step interval to about 4 seconds.
+#ifndef ACCELSTEPPER_FIXED_POINT
+ #if defined(__AVR__)
+  #define ACCELSTEPPER_FIXED_POINT 1
+ #else
+  #define ACCELSTEPPER_FIXED_POINT 0
+ #endif
+#endif
+
 // Use the system yield() whenever possoible, since some platforms require it for housekeeping, especially
 // ESP8266
 #if (defined(ARDUINO) && ARDUINO >= 155) || defined(ESP8266)
@@ -395,6 +407,38 @@ public:
     /// anticlockwise from the current position.
     void    move(long relative);
 
+    /// Supplies a buffer for a queue of target positions to follow the current one, so a
+    /// sequence of moves can be given up front. When run() or runFromTimer() reaches the
+    /// target position it carries straight on to the next queued one. Consecutive segments
+    /// in the same direction are planned as a single move, so the motor only slows at a
+    /// junction as much as is needed to stop at the end of the run, and only comes to a
+    /// stop where the direction reverses or the queue runs out.
+    /// moveTo() still changes the current target immediately, and leaves the queue alone.
+    /// \param[in] queue Buffer of at least size entries, which must outlive the stepper. NULL disables the queue.
+    /// \param[in] size Number of entries in queue
+    void    setQueue(long* queue, uint8_t size);
+
+    /// Adds a target position to the end of the queue set by setQueue().
+    /// If the motor is already at its target and nothing is queued, this starts the move straight away like moveTo().
+    /// \param[in] absolute The desired absolute position
+    /// \return true if it was queued, false if the queue is full
+    boolean queueMoveTo(long absolute);
+
+    /// Adds a target position relative to the last queued one (or the current target if the queue is empty)
+    /// to the end of the queue.
+    /// \param[in] relative The desired position relative to the last queued position
+    /// \return true if it was queued, false if the queue is full
+    boolean queueMove(long relative);
+
+    /// \return the number of target positions waiting in the queue, not counting the current target
+    uint8_t queueLength();
+
+    /// \return the last queued target position, or the current target position if the queue is empty
+    long    queueEndPosition();
+
+    /// Discards all queued target positions. The current move carries on to the current target.
+    void    clearQueue();
+
     /// Poll the motor and step it if a step is due, implementing
     /// accelerations and decelerations to achieve the target position. You must call this as
     /// frequently as possible, but at least once per minimum step time interval,
@@ -409,6 +453,62 @@ public:
     /// \return true if the motor was stepped.
     boolean runSpeed();
 
+    /// Selects how runSpeed() times the next step. By default each step interval is measured from
+    /// the time the last step was actually taken, so any lateness in polling runSpeed() (and the
+    /// cost of step() itself) is lost, and the motor runs slower than the requested speed.
+    /// With scheduled stepping each step is due exactly one interval after the previous one was due,
+    /// so lateness is made up by the next step and the average speed is kept.
+    /// Whichever is selected, a step more than a whole interval late is not caught up, since that
+    /// would mean exceeding the speed. Those steps are counted by missedSteps() and the schedule restarts.
+    /// \param[in] scheduled true to keep steps to an absolute schedule
+    void    setScheduledStepping(bool scheduled);
+
+    /// The number of steps taken by runSpeed() or runFromTimer() more than 1/8 of a step interval late,
+    /// since construction or the last resetStepStats(). Shows how often the caller polls too slowly.
+    /// \return Late step count
+    unsigned long lateSteps();
+
+    /// The number of whole step intervals lost by runSpeed() or runFromTimer() because it was polled too slowly to take
+    /// the step in time, since construction or the last resetStepStats().
+    /// \return Missed step count
+    unsigned long missedSteps();
+
+    /// The worst lateness of any step taken by runSpeed() or runFromTimer(), since construction or the last resetStepStats().
+    /// \return Maximum lateness in microseconds
+    unsigned long maxLateness();
+
+    /// Clears the counters returned by lateSteps(), missedSteps() and maxLateness(), and the
+    /// lateness histogram
+    void    resetStepStats();
+
+    /// Supplies a buffer for a histogram of how late runSpeed() takes each step, in log2 buckets.
+    /// Bucket 0 counts steps less than 1us late, bucket n those at least 2^(n-1)us and less than 2^n us late,
+    /// and the last bucket everything later than that. When a count would overflow all of them are halved,
+    /// so the histogram keeps its shape over long runs.
+    /// Cleared by resetStepStats(). Steps generated by runFromTimer() are counted with the lateness its caller passes.
+    /// \param[in] buckets Buffer of at least count entries, which must outlive the stepper. NULL disables the histogram.
+    /// \param[in] count Number of entries in buckets
+    void    setLatenessHistogram(uint16_t* buckets, uint8_t count);
+
+    /// Step the motor unconditionally and compute the interval to the next step, implementing
+    /// accelerations and decelerations to achieve the target position. This is intended to be called
+    /// from a hardware timer interrupt that reloads its compare value with the returned interval,
+    /// so that step timing does not depend on how often the main loop runs.
+    /// The caller is responsible for
+    /// protecting calls to moveTo(), setMaxSpeed() etc in the foreground with noInterrupts().
+    /// Do not mix with run() or runSpeed() on the same stepper.
+    /// \param[in] late How late this step is in microseconds, if the caller can tell, for lateSteps() etc.
+    /// The caller should not catch up a step a whole interval late, but restart its schedule from it.
+    /// \return the interval in microseconds until the next step is due, or 0 if the motor has stopped
+    /// and the timer should be disabled.
+    unsigned long runFromTimer(unsigned long late = 0);
+
+    /// The time until the next step is due, counted from the last step taken like runSpeed() does.
+    /// A timer driving runFromTimer() waits this long before the first step of a move, so a move that
+    /// starts just as another one ends, such as a reversal, does not take its first step too soon.
+    /// \return the delay in microseconds, 0 if the step is due now or the motor is stopped
+    unsigned long nextStepDelay();
+
     /// Sets the maximum permitted speed. The run() function will accelerate
     /// up to the speed set by this function.
     /// Caution: the maximum speed achievable depends on your processor and clock speed.
@@ -423,12 +523,39 @@ public:
     /// \return The currently configured maximum speed
     float   maxSpeed();
 
+    /// Returns the acceleration configured for this stepper
+    /// that was previously set by setAcceleration();
+    /// \return The currently configured acceleration
+    float   acceleration();
+
     /// Sets the acceleration/deceleration rate.
     /// \param[in] acceleration The desired acceleration in steps per second
     /// per second. Must be > 0.0. This is an expensive call since it requires a square 
     /// root to be calculated. Dont call more ofthen than needed
     void    setAcceleration(float acceleration);
 
+    /// Selects a jerk limited (S-curve) motion profile instead of the default trapezoidal one.
+    /// The acceleration then ramps up and down at the given rate instead of changing instantly,
+    /// which avoids exciting resonances in heavy loads, at the cost of slightly longer moves.
+    /// The acceleration set by setAcceleration() is the maximum it will reach. Changing the target with
+    /// moveTo() during a move blends smoothly into the new one, including reversing.
+    /// This uses floating point maths and sqrt() after every step, so is considerably more expensive
+    /// than the trapezoidal profile. Dont change it while the motor is moving.
+    /// \param[in] jerk The maximum rate of change of acceleration in steps per second per second per second.
+    /// 0.0 (the default) selects the trapezoidal profile.
+    void    setJerk(float jerk);
+
+    /// Supplies a buffer for a precomputed table of step intervals for the acceleration phase.
+    /// The table is filled with the Equation 13 sequence from the first step up to max speed,
+    /// and rebuilt whenever setAcceleration() or setMaxSpeed() change it. Moves then look up their
+    /// step intervals, forwards while accelerating and backwards while decelerating, instead of
+    /// computing them. Steps beyond the end of the table fall back to live computation, so the
+    /// table can be much shorter than the full ramp. Each entry costs 2 bytes of RAM.
+    /// The table is not used if the first step interval does not fit in 16 bits (very low accelerations).
+    /// \param[in] table Buffer of at least size entries, which must outlive the stepper. NULL disables the table.
+    /// \param[in] size Number of entries in table
+    void    setRampTable(uint16_t* table, uint16_t size);
+
     /// Sets the desired constant speed for use with runSpeed().
     /// \param[in] speed The desired constant speed in steps per
     /// second. Positive is clockwise. Speeds of more than 1000 steps per
@@ -439,6 +566,7 @@ public:
     void    setSpeed(float speed);
 
     /// The most recently set speed.
+    /// With ACCELSTEPPER_FIXED_POINT, this is computed on demand from the current step interval.
     /// \return the most recent speed in steps per second
     float   speed();
 
@@ -461,7 +589,7 @@ public:
     /// happens to be right now is considered to be the new 0 position. Useful
     /// for setting a zero position on a stepper after an initial hardware
     /// positioning move.
-    /// Has the side effect of setting the current motor speed to 0.
+    /// Has the side effect of setting the current motor speed to 0, and discarding any queued target positions.
     /// \param[in] position The position in steps of wherever the motor
     /// happens to be right now.
     void    setCurrentPosition(long position);  
@@ -484,6 +612,7 @@ public:
 
     /// Sets a new target position that causes the stepper
     /// to stop as quickly as possible, using the current speed and acceleration parameters.
+    /// Also discards any queued target positions.
     void stop();
 
     /// Disable motor pin outputs by setting them all LOW
@@ -533,6 +662,12 @@ public:
     /// \return true if the speed is not zero or not at the target position
     bool    isRunning();
 
+    /// Takes one step in the given direction straight away and updates the current position,
+    /// ignoring the target position, speed and acceleration. For steppers whose timing comes
+    /// from somewhere else, such as the slave axes of an accelerated MultiStepper move, rather than run().
+    /// \param[in] clockwise true to step clockwise (increasing position), false for anticlockwise
+    void    stepOnce(boolean clockwise);
+
 protected:
 
     /// \brief Direction indicator
@@ -560,6 +695,39 @@ protected:
     /// output pins directly
     virtual void   setOutputPins(uint8_t mask);
 
+    /// computeNewSpeed() for the S-curve profile selected by setJerk()
+    void           computeNewSpeedSCurve();
+
+    /// Sets up the first step of an S-curve move from rest
+    /// \param[in] distanceTo Distance to the target, +ve is clockwise
+    void           startSCurve(long distanceTo);
+
+    /// The distance needed to stop with the S-curve profile
+    /// \param[in] speed The current speed in steps per second, +ve
+    /// \param[in] accel The current acceleration in steps per second per second, +ve if speeding up
+    /// \return Steps to stop
+    long           scurveStepsToStop(float speed, float accel);
+
+    /// Fills the ramp table from the current c0 and cmin
+    void           buildRampTable();
+
+    /// Counts a late step in the step statistics
+    /// \param[in] late How late the step was in microseconds
+    /// \return true if it was a whole step interval or more late, too late to be caught up
+    boolean        recordLateness(unsigned long late);
+
+    /// The distance to the end of the run of queued segments that continue in the same
+    /// direction as the current one, which is where the motor needs to be able to stop
+    /// \return the distance from the current position, +ve is clockwise
+    long           plannedDistanceToGo();
+
+#if ACCELSTEPPER_FIXED_POINT
+    /// Converts a step interval to the fixed point format used by the ramp
+    /// \param[in] us Step interval in microseconds
+    /// \return The interval in 1/256 microseconds, clamped to what Equation 13 can handle
+    static long    toFixed(float us);
+#endif
+
     /// Called to execute a step. Only called when a new step is
     /// required. Subclasses may override to implement new stepping
     /// interfaces. The default calls step1(), step2(), step4() or step8() depending on the
@@ -614,6 +782,10 @@ protected:
     /// \param[in] step The current step phase number (0 to 7)
     virtual void   step8(long step);
 
+    /// The minimum step pulse width set by setMinPulseWidth(), for subclasses that implement their own step()
+    /// \return The minimum pulse width in microseconds
+    unsigned int   minPulseWidth() { return _minPulseWidth; }
+
     /// Current direction motor is spinning in
     /// Protected because some peoples subclasses need it to be so
     boolean _direction; // 1 == CW
@@ -640,6 +812,8 @@ private:
 
     /// The current motos speed in steps per second
     /// Positive is clockwise
+    /// With ACCELSTEPPER_FIXED_POINT, the ramp only keeps the sign of this up to date (+/-1.0 or 0.0),
+    /// use speed() for the magnitude
     float          _speed;         // Steps per second
 
     /// The maximum permitted speed in steps per second. Must be > 0.
@@ -657,6 +831,27 @@ private:
     /// The last step time in microseconds
     unsigned long  _lastStepTime;
 
+    /// True if runSpeed() keeps steps to an absolute schedule, see setScheduledStepping()
+    bool           _scheduledStepping;
+
+    /// True if the next step starts a new schedule, because the motor was stopped
+    bool           _scheduleRestart;
+
+    /// Steps taken more than 1/8 of an interval late
+    unsigned long  _lateSteps;
+
+    /// Step intervals lost by being more than a whole interval late
+    unsigned long  _missedSteps;
+
+    /// Worst lateness of a step in microseconds
+    unsigned long  _maxLateness;
+
+    /// Log2 histogram of step lateness, see setLatenessHistogram()
+    uint16_t*      _histogram;
+
+    /// Number of entries in _histogram
+    uint8_t        _histogramSize;
+
     /// The minimum allowed pulse width in microseconds
     unsigned int   _minPulseWidth;
 
@@ -690,6 +885,53 @@ private:
     /// Min step size in microseconds based on maxSpeed
     float _cmin; // at max speed
 
+    /// Max rate of change of acceleration for the S-curve profile, or 0.0 for trapezoidal
+    float          _jerk;
+
+    /// S-curve acceleration at the last step, signed like _speed
+    float          _scurveAccel;
+
+    /// Position at which the S-curve speed was last updated
+    long           _scurvePos;
+
+    /// True when the S-curve move is too short to ramp, and steps at the speed of the first step
+    bool           _scurveCreep;
+
+    /// Precomputed step intervals in microseconds for the acceleration phase, see setRampTable()
+    uint16_t* _rampTable;
+
+    /// Number of entries in _rampTable
+    uint16_t _rampSize;
+
+    /// Number of valid entries in _rampTable
+    uint16_t _rampLen;
+
+    /// Ring buffer of target positions to follow _targetPos, see setQueue()
+    long*          _queue;
+
+    /// Number of entries in _queue
+    uint8_t        _queueSize;
+
+    /// Index in _queue of the next target position
+    uint8_t        _queueHead;
+
+    /// Number of target positions waiting in _queue
+    uint8_t        _queueCount;
+
+#if ACCELSTEPPER_FIXED_POINT
+    /// Initial step size in 1/256 microseconds
+    long _c0q;
+
+    /// Last step size in 1/256 microseconds
+    long _cnq;
+
+    /// Min step size in 1/256 microseconds based on maxSpeed
+    long _cminq;
+
+    /// Steps needed to stop from maxSpeed, per Equation 16
+    long _nmax;
+#endif
+
 };
 
 /// @example Random.pde
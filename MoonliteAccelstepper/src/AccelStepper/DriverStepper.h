@@ -0,0 +1,121 @@
+// DriverStepper.h
+//
+// AccelStepper specialised at compile time for step/direction drivers
+
+#ifndef DriverStepper_h
+#define DriverStepper_h
+
+#include "AccelStepper.h"
+
+/////////////////////////////////////////////////////////////////////
+/// \class DriverStepper DriverStepper.h <DriverStepper.h>
+/// \brief AccelStepper for a step/direction driver with pins fixed at compile time
+///
+/// This is equivalent to AccelStepper(AccelStepper::DRIVER, StepPin, DirPin), but
+/// the interface and pin inversion are template parameters, so step() does not
+/// switch on the interface or loop over the pins calling digitalWrite(). On AVR the
+/// port registers and bit masks are looked up once at construction, and each
+/// step is a direction write and two writes to the step pin's port.
+/// On other architectures it falls back to digitalWrite(), still without the
+/// per-step switch and inversion.
+///
+/// All the usual AccelStepper functions work, and a DriverStepper can be passed
+/// anywhere an AccelStepper& is expected (StepTimer, MultiStepper etc).
+/// Step and direction inversion come from the template parameters, and are not
+/// changed by setPinsInverted(), which should still be used for the enable pin.
+///
+/// \tparam StepPin Arduino digital pin number for the Step input of the driver
+/// \tparam DirPin Arduino digital pin number for the Direction input of the driver
+/// \tparam DirInvert True for inverted direction pin
+/// \tparam StepInvert True for inverted step pin
+template <uint8_t StepPin, uint8_t DirPin, bool DirInvert = false, bool StepInvert = false>
+class DriverStepper : public AccelStepper
+{
+public:
+    /// Constructor
+    /// \param[in] enable If this is true (the default), enableOutputs() will be called to enable
+    /// the output pins at construction time.
+    DriverStepper(bool enable = true)
+	: AccelStepper(AccelStepper::DRIVER, StepPin, DirPin, 4, 5, enable)
+    {
+#if defined(__AVR__)
+	_stepReg = portOutputRegister(digitalPinToPort(StepPin));
+	_stepMask = digitalPinToBitMask(StepPin);
+	_dirReg = portOutputRegister(digitalPinToPort(DirPin));
+	_dirMask = digitalPinToBitMask(DirPin);
+#endif
+    }
+
+protected:
+    /// Sets the direction and pulses the step pin for the minimum pulse width
+    /// \param[in] step The current step phase number (unused)
+    virtual void step(long step)
+    {
+	(void)(step); // Unused
+
+	// Set direction first else get rogue pulses
+	writeDir(_direction);
+	writeStep(true);
+	// Caution 200ns setup time
+	delayMicroseconds(minPulseWidth());
+	writeStep(false);
+    }
+
+    /// Sets the step and direction pins from a mask, as AccelStepper::setOutputPins()
+    /// bit 0 of the mask corresponds to the step pin
+    /// bit 1 of the mask corresponds to the direction pin
+    virtual void setOutputPins(uint8_t mask)
+    {
+	writeDir(mask & 0b10);
+	writeStep(mask & 0b01);
+    }
+
+private:
+    /// Writes the step pin, applying StepInvert
+    inline void writeStep(bool high)
+    {
+#if defined(__AVR__)
+	uint8_t oldSREG = SREG;
+	cli();
+	if (high != StepInvert)
+	    *_stepReg |= _stepMask;
+	else
+	    *_stepReg &= ~_stepMask;
+	SREG = oldSREG;
+#else
+	digitalWrite(StepPin, (high != StepInvert) ? HIGH : LOW);
+#endif
+    }
+
+    /// Writes the direction pin, applying DirInvert
+    inline void writeDir(bool high)
+    {
+#if defined(__AVR__)
+	uint8_t oldSREG = SREG;
+	cli();
+	if (high != DirInvert)
+	    *_dirReg |= _dirMask;
+	else
+	    *_dirReg &= ~_dirMask;
+	SREG = oldSREG;
+#else
+	digitalWrite(DirPin, (high != DirInvert) ? HIGH : LOW);
+#endif
+    }
+
+#if defined(__AVR__)
+    /// Output register for the step pin
+    volatile uint8_t* _stepReg;
+
+    /// Bit of the step pin in _stepReg
+    uint8_t           _stepMask;
+
+    /// Output register for the direction pin
+    volatile uint8_t* _dirReg;
+
+    /// Bit of the direction pin in _dirReg
+    uint8_t           _dirMask;
+#endif
+};
+
+#endif
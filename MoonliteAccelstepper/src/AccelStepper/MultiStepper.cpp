@@ -7,10 +7,17 @@
 #include "AccelStepper.h"
 
 MultiStepper::MultiStepper()
-    : _num_steppers(0)
+    : _num_steppers(0),
+      _accelerated(false),
+      _moving(false)
 {
 }
 
+void MultiStepper::setAccelerated(boolean accelerated)
+{
+    _accelerated = accelerated;
+}
+
 boolean MultiStepper::addStepper(AccelStepper& stepper)
 {
     if (_num_steppers >= MULTISTEPPER_MAX_STEPPERS)
@@ -21,6 +28,12 @@ boolean MultiStepper::addStepper(AccelStepper& stepper)
 
 void MultiStepper::moveTo(long absolute[])
 {
+    if (_accelerated)
+    {
+	moveToAccelerated(absolute);
+	return;
+    }
+
     // First find the stepper that will take the longest time to move
     float longestTime = 0.0;
 
@@ -48,11 +61,110 @@ void MultiStepper::moveTo(long absolute[])
     }
 }
 
+// The stepper with the furthest to go is the master, and the line from its
+// start to its target is the one the others follow
+void MultiStepper::moveToAccelerated(long absolute[])
+{
+    if (_moving)
+	finishMove();
+
+    uint8_t i;
+    _masterSteps = 0;
+    for (i = 0; i < _num_steppers; i++)
+    {
+	_delta[i] = absolute[i] - _steppers[i]->currentPosition();
+	if (labs(_delta[i]) > _masterSteps)
+	{
+	    _masterSteps = labs(_delta[i]);
+	    _master = i;
+	}
+    }
+    if (!_masterSteps)
+	return;
+
+    // Each stepper moves at most as fast as the master, scaled by its share of the distance
+    AccelStepper* master = _steppers[_master];
+    _masterMaxSpeed = master->maxSpeed();
+    _masterAcceleration = master->acceleration();
+    float maxSpeed = _masterMaxSpeed;
+    float acceleration = _masterAcceleration;
+    for (i = 0; i < _num_steppers; i++)
+    {
+	if (!_delta[i])
+	    continue;
+	float ratio = (float)_masterSteps / labs(_delta[i]);
+	maxSpeed = min(maxSpeed, _steppers[i]->maxSpeed() * ratio);
+	acceleration = min(acceleration, _steppers[i]->acceleration() * ratio);
+    }
+    master->setMaxSpeed(maxSpeed);
+    master->setAcceleration(acceleration);
+    // Each of the others steps on the master step that takes it past its share, rather than the
+    // nearest, so its last step is the master's last step rather than one before
+    for (i = 0; i < _num_steppers; i++)
+    {
+	_error[i] = 0;
+	_steppers[i]->moveTo(absolute[i]);
+    }
+    _masterPos = master->currentPosition();
+    _moving = true;
+}
+
+void MultiStepper::finishMove()
+{
+    AccelStepper* master = _steppers[_master];
+    master->setMaxSpeed(_masterMaxSpeed);
+    master->setAcceleration(_masterAcceleration);
+    for (uint8_t i = 0; i < _num_steppers; i++)
+	_steppers[i]->setCurrentPosition(_steppers[i]->currentPosition());
+    _moving = false;
+}
+
 // Returns true if any motor is still running to the target position.
 boolean MultiStepper::run()
 {
     uint8_t i;
     boolean ret = false;
+    if (_accelerated)
+    {
+	if (!_moving)
+	    return false;
+	AccelStepper* master = _steppers[_master];
+	ret = master->run();
+	long pos = master->currentPosition();
+	if (pos != _masterPos)
+	{
+	    // The master stepped, step the others if due. Any overshoot is followed back the same way
+	    boolean forward = (pos > _masterPos) == (_delta[_master] > 0);
+	    _masterPos = pos;
+	    for (i = 0; i < _num_steppers; i++)
+	    {
+		if (i == _master || !_delta[i])
+		    continue;
+		if (forward)
+		{
+		    _error[i] += labs(_delta[i]);
+		    if (_error[i] >= _masterSteps)
+		    {
+			_error[i] -= _masterSteps;
+			_steppers[i]->stepOnce(_delta[i] > 0);
+		    }
+		}
+		else
+		{
+		    _error[i] -= labs(_delta[i]);
+		    if (_error[i] < 0)
+		    {
+			_error[i] += _masterSteps;
+			_steppers[i]->stepOnce(_delta[i] < 0);
+		    }
+		}
+	    }
+	}
+	if (!ret)
+	    finishMove();
+	return ret;
+    }
+
     for (i = 0; i < _num_steppers; i++)
     {
 	if ( _steppers[i]->distanceToGo() != 0)
@@ -27,9 +27,12 @@ class AccelStepper;
 /// 3D printers etc
 /// to get linear straight line movement between arbitrary 2d (or 3d or ...) positions.
 ///
-/// Caution: only constant speed stepper motion is supported: acceleration and deceleration is not supported
+/// By default only constant speed stepper motion is supported: acceleration and deceleration is not supported
 /// All the steppers managed by MultiStepper will step at a constant speed to their
 /// target (albeit perhaps different speeds for each stepper).
+/// After setAccelerated(true), the stepper with the furthest to go runs its usual accelerated
+/// profile, and the others are stepped in proportion to it (Bresenham's line algorithm), so they all
+/// accelerate, decelerate and arrive together.
 class MultiStepper
 {
 public:
@@ -50,9 +53,19 @@ public:
     /// the absolute position of the first stepper added by addStepper() etc. The array must be at least as long as 
     /// the number of steppers that have been added by addStepper, else results are undefined.
     void moveTo(long absolute[]);
+
+    /// Selects accelerated moves. The stepper with the furthest to go becomes the master
+    /// for the next moveTo(), and runs with its own acceleration profile (trapezoidal, or
+    /// S-curve if it has a jerk set), with the max speed and acceleration reduced if needed so
+    /// no stepper exceeds its own. Every step of the master steps each of the other steppers if
+    /// due, so they all stay in proportion along the move. The master's max speed and acceleration are put back
+    /// when the move finishes. Dont call moveTo() again until run() has returned false.
+    /// \param[in] accelerated true for accelerated moves, false (the default) for constant speed moves
+    void setAccelerated(boolean accelerated);
     
     /// Calls runSpeed() on all the managed steppers
     /// that have not acheived their target position.
+    /// For accelerated moves, calls run() on the master and steps the others in proportion.
     /// \return true if any stepper is still in the process of running to its target position.
     boolean run();
 
@@ -69,6 +82,37 @@ private:
     /// Number of steppers we are controlling and the number
     /// of steppers in _steppers[]
     uint8_t       _num_steppers;
+
+    /// True if moveTo() plans accelerated moves, see setAccelerated()
+    boolean       _accelerated;
+
+    /// True while an accelerated move is in progress
+    boolean       _moving;
+
+    /// Index in _steppers[] of the master of the accelerated move
+    uint8_t       _master;
+
+    /// Number of steps the master has to make
+    long          _masterSteps;
+
+    /// Master position when its steps were last passed on to the others
+    long          _masterPos;
+
+    /// The master's own max speed and acceleration, put back at the end of the move
+    float         _masterMaxSpeed;
+    float         _masterAcceleration;
+
+    /// Signed distance each stepper has to move
+    long          _delta[MULTISTEPPER_MAX_STEPPERS];
+
+    /// Bresenham error term for each stepper
+    long          _error[MULTISTEPPER_MAX_STEPPERS];
+
+    /// moveTo() for accelerated moves
+    void          moveToAccelerated(long absolute[]);
+
+    /// Ends an accelerated move, and clears the speed state the slaved steppers were left with
+    void          finishMove();
 };
 
 /// @example MultiStepper.pde
@@ -0,0 +1,195 @@
+// Backlash.h
+//
+// Finishes every move from the same direction, to take up backlash in the focuser
+
+#ifndef Backlash_h
+#define Backlash_h
+
+#include <stdlib.h>
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#include <wiring.h>
+#endif
+
+/////////////////////////////////////////////////////////////////////
+/// \class Backlash Backlash.h <Backlash.h>
+/// \brief Moves a motor so it always arrives at its target from the same side
+///
+/// Slack in the gears means the focuser ends up in a slightly different place for
+/// the same motor position depending on which way it last moved. Moving through
+/// this class instead of moveTo() makes every move finish in the approach
+/// direction: a target that the motor would reach going the other way is first
+/// overshot by the overshoot distance, then approached from there.
+///
+/// The overshoot and the return are one move as far as the caller is concerned:
+/// the return is started by run() in the same call that finishes the overshoot, so
+/// there is no gap while the motor sits waiting for a command, the outputs stay
+/// enabled and isRunning() is true throughout. Only the reversal itself adds to
+/// the move time.
+///
+/// Works with anything with AccelStepper's moveTo(), run(), distanceToGo() and
+/// currentPosition(). queueMoveTo() also needs a queue, see AccelStepper::setQueue(),
+/// stop() needs stop() and speed(), jog() those and setMaxSpeed(), and setCurrentPosition()
+/// needs setCurrentPosition().
+///
+/// \tparam Motor AccelStepper or StepTimer
+template <class Motor>
+class Backlash
+{
+public:
+    /// Constructor. Starts off, moving straight to every target.
+    /// \param[in] motor The motor to move
+    Backlash(Motor& motor)
+	: _motor(&motor),
+	  _direction(0),
+	  _overshoot(0),
+	  _pending(false),
+	  _target(0),
+	  _slowing(false),
+	  _jogTarget(0),
+	  _jogSpeed(0)
+    {
+    }
+
+    /// Sets which way moves finish
+    /// \param[in] direction 1 to always finish moving towards higher positions, -1 towards lower, 0 not to care
+    void    setDirection(int8_t direction) { _direction = direction > 0 ? 1 : direction < 0 ? -1 : 0; }
+
+    /// \return 1 if moves finish towards higher positions, -1 towards lower, 0 if they go straight to the target
+    int8_t  direction() { return _direction; }
+
+    /// Sets how far past the target a move from the wrong side goes before coming back.
+    /// It needs to be more than the backlash.
+    /// \param[in] steps Motor steps
+    void    setOvershoot(long steps) { _overshoot = labs(steps); }
+
+    /// \return How far past the target a move from the wrong side goes, in motor steps
+    long    overshoot() { return _overshoot; }
+
+    /// Sets a new target, overshooting it first if the motor would otherwise arrive the wrong way.
+    /// Replaces any move in progress, from wherever the motor has got to.
+    /// \param[in] absolute Target position
+    void    moveTo(long absolute)
+    {
+	_pending = false;
+	_slowing = false;
+	long from = _motor->currentPosition();
+	if (!_direction || !_overshoot || absolute == from || (absolute > from) == (_direction > 0))
+	{
+	    _motor->moveTo(absolute);
+	    return;
+	}
+	_motor->moveTo(absolute - _direction * _overshoot);
+	_target = absolute;
+	_pending = true;
+    }
+
+    /// Adds a target to the end of the motor's queue if it is reached in the approach direction
+    /// from the end of the queue, so a series of moves that way still runs straight through.
+    /// Otherwise the queue is dropped and it is moved to with moveTo().
+    /// \param[in] absolute Target position
+    /// \return false if the queue is full
+    boolean queueMoveTo(long absolute)
+    {
+	long from = _motor->queueEndPosition();
+	if (!_pending && !_slowing && (!_direction || absolute == from || (absolute > from) == (_direction > 0)))
+	    return _motor->queueMoveTo(absolute);
+	_motor->clearQueue();
+	moveTo(absolute);
+	return true;
+    }
+
+    /// Forgets the return from an overshoot, and any jog waiting to slow down, for when the motor is being stopped
+    void    cancel() { _pending = _slowing = false; }
+
+    /// Resets the motor's position, as its setCurrentPosition(). Any return from an overshoot is
+    /// forgotten too, since its target was in the old positions.
+    /// \param[in] position The position the motor is now at
+    void    setCurrentPosition(long position)
+    {
+	_pending = _slowing = false;
+	_motor->setCurrentPosition(position);
+    }
+
+    /// Ramps down to a stop as quickly as the acceleration allows, then comes back if it stopped
+    /// going the wrong way, as for moveTo(). For ending a jog towards a far away target.
+    /// \param[in] unit Stops on a multiple of this many motor steps, going on to the next one rather than back
+    void    stop(long unit = 1)
+    {
+	// AccelStepper::stop() leaves the target alone before the first step, when there is no speed to lose
+	float speed = _motor->speed();
+	long to = _motor->currentPosition();
+	if (speed != 0)
+	{
+	    _motor->stop();
+	    to = _motor->targetPosition();
+	}
+	long rest = (to % unit + unit) % unit;
+	if (rest)
+	    to += speed > 0 ? unit - rest : -rest;
+	moveTo(to);
+    }
+
+    /// Moves towards a target at up to a new max speed, as for moveTo(), for starting a jog or changing its
+    /// speed or direction. Lowering the motor's max speed below the speed it is going cuts straight to the
+    /// new step interval, so in that case the motor ramps down first, and run() makes the move once it
+    /// has slowed to the new speed.
+    /// \param[in] absolute Target position, usually an end of travel
+    /// \param[in] maxSpeed The max speed to move at, in steps per second
+    void    jog(long absolute, float maxSpeed)
+    {
+	if (fabs(_motor->speed()) > maxSpeed)
+	{
+	    _motor->stop();
+	    _pending = false;
+	    _slowing = true;
+	    _jogTarget = absolute;
+	    _jogSpeed = maxSpeed;
+	    return;
+	}
+	_motor->setMaxSpeed(maxSpeed);
+	moveTo(absolute);
+    }
+
+    /// Runs the motor, starts the return once it reaches the overshoot, and starts a jog once the motor
+    /// has slowed down for it. Call it in place of the motor's run().
+    /// \return What the motor's run() returned, or true if the return was started
+    boolean run()
+    {
+	boolean ran = _motor->run();
+	if (_slowing && fabs(_motor->speed()) <= _jogSpeed)
+	{
+	    jog(_jogTarget, _jogSpeed);
+	    ran = true;
+	}
+	if (_pending && _motor->distanceToGo() == 0)
+	{
+	    _motor->moveTo(_target);
+	    _pending = false;
+	    ran = true;
+	}
+	return ran;
+    }
+
+    /// \return true while the motor is moving, or has a return from an overshoot or a jog still to do
+    boolean isRunning() { return _pending || _slowing || _motor->distanceToGo() != 0; }
+
+    /// \return Where the motor will end up
+    long    targetPosition() { return _slowing ? _jogTarget : _pending ? _target : _motor->targetPosition(); }
+
+private:
+    Motor*  _motor;
+    int8_t  _direction;
+    long    _overshoot;
+    /// true while overshooting, with the return to _target still to do
+    boolean _pending;
+    long    _target;
+    /// true while slowing down for a jog, with the move to _jogTarget at _jogSpeed still to do
+    boolean _slowing;
+    long    _jogTarget;
+    float   _jogSpeed;
+};
+
+#endif
@@ -0,0 +1,91 @@
+// MoonliteBinary.cpp
+//
+// Fixed size framed packets, an alternative to the Moonlite ASCII protocol for fast polling
+
+#include "MoonliteBinary.h"
+#include "../OneWire/OneWire.h"
+
+static void put32(uint8_t* p, int32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static int32_t get32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+void moonliteEncodeRequest(uint8_t* frame, const MoonliteRequest& request)
+{
+    frame[0] = MOONLITEBINARY_REQUEST_SYNC;
+    frame[1] = request.opcode;
+    frame[2] = request.sequence;
+    put32(&frame[3], request.argument);
+    frame[7] = OneWire::crc8(frame, 7);
+}
+
+boolean moonliteDecodeRequest(const uint8_t* frame, MoonliteRequest& request)
+{
+    if (frame[0] != MOONLITEBINARY_REQUEST_SYNC || OneWire::crc8(frame, 7) != frame[7])
+	return false;
+    request.opcode = frame[1];
+    request.sequence = frame[2];
+    request.argument = get32(&frame[3]);
+    return true;
+}
+
+void moonliteEncodeStatus(uint8_t* frame, const MoonliteStatus& status)
+{
+    frame[0] = MOONLITEBINARY_RESPONSE_SYNC;
+    frame[1] = status.opcode;
+    frame[2] = status.sequence;
+    frame[3] = status.result;
+    frame[4] = status.flags;
+    put32(&frame[5], status.position);
+    put32(&frame[9], status.target);
+    frame[13] = status.temperature;
+    frame[14] = status.temperature >> 8;
+    frame[15] = OneWire::crc8(frame, 15);
+}
+
+boolean moonliteDecodeStatus(const uint8_t* frame, MoonliteStatus& status)
+{
+    if (frame[0] != MOONLITEBINARY_RESPONSE_SYNC || OneWire::crc8(frame, 15) != frame[15])
+	return false;
+    status.opcode = frame[1];
+    status.sequence = frame[2];
+    status.result = frame[3];
+    status.flags = frame[4];
+    status.position = get32(&frame[5]);
+    status.target = get32(&frame[9]);
+    status.temperature = (int16_t)(frame[13] | frame[14] << 8);
+    return true;
+}
+
+boolean MoonliteReceiver::add(uint8_t c)
+{
+    if (!_count && c != MOONLITEBINARY_REQUEST_SYNC)
+	return false;
+    _frame[_count++] = c;
+    if (_count < MOONLITEBINARY_REQUEST_SIZE)
+	return false;
+
+    _count = 0;
+    if (moonliteDecodeRequest(_frame, _request))
+	return true;
+
+    // Not a frame, look for the next sync byte in what arrived after this one
+    for (uint8_t i = 1; i < MOONLITEBINARY_REQUEST_SIZE; i++)
+    {
+	if (_frame[i] == MOONLITEBINARY_REQUEST_SYNC)
+	{
+	    _count = MOONLITEBINARY_REQUEST_SIZE - i;
+	    memmove(_frame, &_frame[i], _count);
+	    break;
+	}
+    }
+    return false;
+}
@@ -0,0 +1,137 @@
+// MoonliteBinary.h
+//
+// Fixed size framed packets, an alternative to the Moonlite ASCII protocol for fast polling
+
+#ifndef MoonliteBinary_h
+#define MoonliteBinary_h
+
+#include <stdlib.h>
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#include <wiring.h>
+#endif
+
+// Every request is 8 bytes:
+//   0    MOONLITEBINARY_REQUEST_SYNC
+//   1    opcode
+//   2    sequence number, echoed in the response
+//   3-6  argument, signed 32 bit little endian
+//   7    CRC of bytes 0-6
+// and every response, whatever the request, is the 16 byte status:
+//   0    MOONLITEBINARY_RESPONSE_SYNC
+//   1    opcode of the request
+//   2    sequence number of the request
+//   3    result, MOONLITEBINARY_OK or an error
+//   4    flags
+//   5-8  position, signed 32 bit little endian
+//   9-12 target position, signed 32 bit little endian
+//   13-14 temperature in 1/128 degrees C, signed 16 bit little endian
+//   15   CRC of bytes 0-14
+// The CRC is the 1-Wire CRC8, OneWire::crc8(). A request with a bad CRC gets no response.
+
+#define MOONLITEBINARY_REQUEST_SYNC  0xA5
+#define MOONLITEBINARY_RESPONSE_SYNC 0x5A
+#define MOONLITEBINARY_REQUEST_SIZE  8
+#define MOONLITEBINARY_RESPONSE_SIZE 16
+
+// Opcodes
+/// Nothing, just the status
+#define MOONLITEBINARY_STATUS        0x00
+/// Move to the argument, in Moonlite steps, like :SN#:FG#
+#define MOONLITEBINARY_MOVE          0x01
+/// Stop, like :FQ#
+#define MOONLITEBINARY_HALT          0x02
+/// Set the current position to the argument, like :SP#
+#define MOONLITEBINARY_SET_POSITION  0x03
+/// Set the speed to the argument, 2, 4, 8, 0x10 or 0x20 like :SD#
+#define MOONLITEBINARY_SET_SPEED     0x04
+/// Temperature compensation on if the argument is not 0, like :+# and :-#
+#define MOONLITEBINARY_TEMP_COMP     0x05
+/// Back to the ASCII protocol, after this response
+#define MOONLITEBINARY_EXIT          0xFF
+
+// Results
+#define MOONLITEBINARY_OK            0x00
+#define MOONLITEBINARY_UNKNOWN       0x01
+#define MOONLITEBINARY_BAD_ARGUMENT  0x02 ///< nothing done
+
+// Flags
+#define MOONLITEBINARY_MOVING        0x01
+#define MOONLITEBINARY_TEMPERATURE   0x02 ///< temperature is a reading
+#define MOONLITEBINARY_TEMP_COMP_ON  0x04
+#define MOONLITEBINARY_HALF_STEP     0x08
+
+/// A request, unpacked
+struct MoonliteRequest
+{
+    uint8_t opcode;
+    uint8_t sequence;
+    int32_t argument;
+};
+
+/// The status response, unpacked
+struct MoonliteStatus
+{
+    uint8_t opcode;
+    uint8_t sequence;
+    uint8_t result;
+    uint8_t flags;
+    int32_t position;
+    int32_t target;
+    int16_t temperature;
+};
+
+/// Packs a request
+/// \param[out] frame Buffer for MOONLITEBINARY_REQUEST_SIZE bytes
+/// \param[in] request The request
+void    moonliteEncodeRequest(uint8_t* frame, const MoonliteRequest& request);
+
+/// Unpacks a request
+/// \param[in] frame MOONLITEBINARY_REQUEST_SIZE bytes
+/// \param[out] request The request
+/// \return false if the sync byte or CRC is wrong
+boolean moonliteDecodeRequest(const uint8_t* frame, MoonliteRequest& request);
+
+/// Packs a status response
+/// \param[out] frame Buffer for MOONLITEBINARY_RESPONSE_SIZE bytes
+/// \param[in] status The status
+void    moonliteEncodeStatus(uint8_t* frame, const MoonliteStatus& status);
+
+/// Unpacks a status response
+/// \param[in] frame MOONLITEBINARY_RESPONSE_SIZE bytes
+/// \param[out] status The status
+/// \return false if the sync byte or CRC is wrong
+boolean moonliteDecodeStatus(const uint8_t* frame, MoonliteStatus& status);
+
+/////////////////////////////////////////////////////////////////////
+/// \class MoonliteReceiver MoonliteBinary.h <MoonliteBinary.h>
+/// \brief Picks requests out of the bytes coming in
+///
+/// Bytes before a sync byte are skipped. When a frame fails its CRC, the
+/// search for the sync byte carries on from the byte after the bad frame's, so
+/// the receiver gets back in step with the sender after noise or a lost byte.
+class MoonliteReceiver
+{
+public:
+    MoonliteReceiver() : _count(0) {}
+
+    /// Adds a byte
+    /// \param[in] c The byte received
+    /// \return true if it completed a good request, for request() to return
+    boolean add(uint8_t c);
+
+    /// \return The request completed by the last add() that returned true
+    const MoonliteRequest& request() { return _request; }
+
+    /// Discards any partial frame
+    void    reset() { _count = 0; }
+
+private:
+    uint8_t         _frame[MOONLITEBINARY_REQUEST_SIZE];
+    uint8_t         _count;
+    MoonliteRequest _request;
+};
+
+#endif
@@ -0,0 +1,39 @@
+// MoonliteHex.cpp
+//
+// Fixed width hex formatting and parsing for the Moonlite protocol
+
+#include "MoonliteHex.h"
+
+char* hexEncode(char* out, unsigned long value, uint8_t digits)
+{
+    char* end = out + digits;
+    while (digits--)
+    {
+	uint8_t d = value & 0xf;
+	out[digits] = d < 10 ? '0' + d : 'A' - 10 + d;
+	value >>= 4;
+    }
+    return end;
+}
+
+uint8_t hexResponse(char* out, unsigned long value, uint8_t digits)
+{
+    *hexEncode(out, value, digits) = '#';
+    return digits + 1;
+}
+
+unsigned long hexDecode(const char* s)
+{
+    unsigned long value = 0;
+    for (;; s++)
+    {
+	uint8_t c = *s;
+	if (c >= '0' && c <= '9')
+	    c -= '0';
+	else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+	    c = (c | 0x20) - 'a' + 10;
+	else
+	    return value;
+	value = (value << 4) | c;
+    }
+}
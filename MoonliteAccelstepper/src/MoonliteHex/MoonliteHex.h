@@ -0,0 +1,46 @@
+// MoonliteHex.h
+//
+// Fixed width hex formatting and parsing for the Moonlite protocol
+
+#ifndef MoonliteHex_h
+#define MoonliteHex_h
+
+#include <stdlib.h>
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#include <wiring.h>
+#endif
+
+/// Most digits hexEncode() can write, enough for an unsigned long
+#define HEX_MAX_DIGITS 8
+
+// Moonlite numbers are fixed width upper case hex: 4 digits for positions and
+// temperatures, 2 for speeds and the like. These replace sprintf("%04X") and
+// strtol(..., 16), which are slow on the AVR and pull in the whole printf
+// implementation for a handful of hex digits.
+
+/// Writes the low digits hex digits of value, most significant first, in upper case.
+/// Negative numbers come out in two's complement, as "%04X" does with a 16 bit int.
+/// \param[out] out Buffer for digits characters. Not NUL terminated.
+/// \param[in] value The number to write
+/// \param[in] digits How many digits to write, up to HEX_MAX_DIGITS
+/// \return Pointer to the character after the last digit
+char*         hexEncode(char* out, unsigned long value, uint8_t digits);
+
+/// Formats a whole Moonlite response: value as digits hex digits followed by #,
+/// so it can be sent with a single write.
+/// \param[out] out Buffer for digits + 1 characters. Not NUL terminated.
+/// \param[in] value The number to send
+/// \param[in] digits How many digits to write, up to HEX_MAX_DIGITS
+/// \return The number of characters written
+uint8_t       hexResponse(char* out, unsigned long value, uint8_t digits);
+
+/// Parses hex digits, in either case, up to the first character that is not one.
+/// Only the last HEX_MAX_DIGITS digits count.
+/// \param[in] s The digits
+/// \return The value, 0 if s does not start with a hex digit
+unsigned long hexDecode(const char* s);
+
+#endif
@@ -152,6 +152,11 @@ void OneWire::begin(uint8_t pin)
 #if ONEWIRE_SEARCH
 	reset_search();
 #endif
+#if ONEWIRE_ASYNC
+	async_phase = 0;
+	async_present = 0;
+	async_due = 0;
+#endif
 }
 
 
@@ -318,6 +323,171 @@ void OneWire::depower()
 	interrupts();
 }
 
+#if ONEWIRE_ASYNC
+
+// The steps of an asynchronous transaction
+#define ASYNC_IDLE      0
+#define ASYNC_RESET     1   // wait for the wire to be high, then pull it low
+#define ASYNC_PRESENCE  2   // release it and look for a presence pulse
+#define ASYNC_WRITE     3
+#define ASYNC_READ      4
+
+bool OneWire::async_start(bool reset, const uint8_t *wbuf, uint8_t wcount,
+                          uint8_t *rbuf, uint8_t rcount, bool power /* = 0 */)
+{
+	if (async_phase != ASYNC_IDLE) return false;
+	async_wbuf = wbuf;
+	async_wcount = wcount;
+	async_rbuf = rbuf;
+	async_rcount = rcount;
+	async_power = power;
+	async_bit = 0;
+	// let the recovery after the last slot of the previous transaction run out
+	unsigned long now = micros();
+	if (async_due - now > 1000) async_due = now;
+	if (reset) {
+		async_retries = 125;
+		async_phase = ASYNC_RESET;
+	} else {
+		async_next();
+	}
+	return true;
+}
+
+// Wait us from now for the next slot
+uint16_t OneWire::async_schedule(unsigned long now, uint16_t us)
+{
+	async_due = now + us;
+	return us;
+}
+
+// Move on to the writes, the reads, or the end, whichever is left
+void OneWire::async_next(void)
+{
+	async_bit = 0;
+	if (async_wcount) {
+		async_phase = ASYNC_WRITE;
+	} else if (async_rcount) {
+		async_phase = ASYNC_READ;
+	} else {
+		async_phase = ASYNC_IDLE;
+	}
+}
+
+uint16_t OneWire::async_poll(void)
+{
+	IO_REG_TYPE mask IO_REG_MASK_ATTR = bitmask;
+	volatile IO_REG_TYPE *reg IO_REG_BASE_ATTR = baseReg;
+	unsigned long now;
+	uint8_t r;
+
+	if (async_phase == ASYNC_IDLE) return 0;
+	now = micros();
+	if ((long)(async_due - now) > 0) return async_due - now;
+
+	switch (async_phase) {
+	case ASYNC_RESET:
+		noInterrupts();
+		DIRECT_MODE_INPUT(reg, mask);
+		interrupts();
+		// wait until the wire is high, up to 250uS as reset() does
+		if (!DIRECT_READ(reg, mask)) {
+			if (--async_retries == 0) {
+				async_present = 0;
+				async_phase = ASYNC_IDLE;
+				return 0;
+			}
+			return async_schedule(now, 2);
+		}
+		noInterrupts();
+		DIRECT_WRITE_LOW(reg, mask);
+		DIRECT_MODE_OUTPUT(reg, mask);	// drive output low
+		interrupts();
+		async_phase = ASYNC_PRESENCE;
+		return async_schedule(now, 480);
+
+	case ASYNC_PRESENCE:
+		noInterrupts();
+		DIRECT_MODE_INPUT(reg, mask);	// allow it to float
+		delayMicroseconds(70);
+		r = !DIRECT_READ(reg, mask);
+		interrupts();
+		async_present = r;
+		if (r) {
+			async_next();
+		} else {
+			async_phase = ASYNC_IDLE;
+		}
+		async_schedule(micros(), 410);
+		break;
+
+	case ASYNC_WRITE:
+		if ((*async_wbuf >> async_bit) & 1) {
+			noInterrupts();
+			DIRECT_WRITE_LOW(reg, mask);
+			DIRECT_MODE_OUTPUT(reg, mask);	// drive output low
+			delayMicroseconds(10);
+			DIRECT_WRITE_HIGH(reg, mask);	// drive output high
+			interrupts();
+			r = 55;
+		} else {
+			noInterrupts();
+			DIRECT_WRITE_LOW(reg, mask);
+			DIRECT_MODE_OUTPUT(reg, mask);	// drive output low
+			interrupts();
+			// a 0 may be held low for up to 120uS, so a short interrupt here only stretches it
+			delayMicroseconds(65);
+			noInterrupts();
+			DIRECT_WRITE_HIGH(reg, mask);	// drive output high
+			interrupts();
+			r = 5;
+		}
+		if (++async_bit == 8) {
+			async_wbuf++;
+			if (--async_wcount == 0) {
+				if (!async_power) {
+					noInterrupts();
+					DIRECT_MODE_INPUT(reg, mask);
+					DIRECT_WRITE_LOW(reg, mask);
+					interrupts();
+				}
+				async_next();
+			} else {
+				async_bit = 0;
+			}
+		}
+		async_schedule(micros(), r);
+		break;
+
+	case ASYNC_READ:
+		if (async_bit == 0) *async_rbuf = 0;
+		noInterrupts();
+		DIRECT_MODE_OUTPUT(reg, mask);
+		DIRECT_WRITE_LOW(reg, mask);
+		delayMicroseconds(3);
+		DIRECT_MODE_INPUT(reg, mask);	// let pin float, pull up will raise
+		delayMicroseconds(10);
+		r = DIRECT_READ(reg, mask);
+		interrupts();
+		if (r) *async_rbuf |= 1 << async_bit;
+		if (++async_bit == 8) {
+			async_bit = 0;
+			async_rbuf++;
+			if (--async_rcount == 0) {
+				async_phase = ASYNC_IDLE;
+			}
+		}
+		async_schedule(micros(), 53);
+		break;
+	}
+	// when done, the recovery time of the last slot is left for the next transaction
+	if (async_phase == ASYNC_IDLE) return 0;
+	long wait = (long)(async_due - micros());
+	return wait > 0 ? wait : 1;
+}
+
+#endif
+
 #if ONEWIRE_SEARCH
 
 //
@@ -51,6 +51,11 @@
 #define ONEWIRE_CRC16 1
 #endif
 
+// You can exclude the asynchronous transactions by defining this to 0
+#ifndef ONEWIRE_ASYNC
+#define ONEWIRE_ASYNC 1
+#endif
+
 // Board-specific macros for direct GPIO
 #include "util/OneWire_direct_regtype.h"
 
@@ -68,6 +73,23 @@ class OneWire
     bool LastDeviceFlag;
 #endif
 
+#if ONEWIRE_ASYNC
+    // asynchronous transaction state
+    uint8_t async_phase;
+    uint8_t async_present;
+    uint8_t async_retries;
+    uint8_t async_bit;
+    bool async_power;
+    const uint8_t *async_wbuf;
+    uint8_t async_wcount;
+    uint8_t *async_rbuf;
+    uint8_t async_rcount;
+    unsigned long async_due;
+
+    uint16_t async_schedule(unsigned long now, uint16_t us);
+    void async_next(void);
+#endif
+
   public:
     OneWire() { }
     OneWire(uint8_t pin) { begin(pin); }
@@ -111,6 +133,41 @@ class OneWire
     // someone shorts your bus.
     void depower(void);
 
+#if ONEWIRE_ASYNC
+    // Asynchronous transactions, for when the caller has better things
+    // to do than wait out the 1-Wire timing. A transaction is an optional
+    // reset, then writing some bytes, then reading some bytes, run one
+    // time slot per call to async_poll(). Only the part of a slot that
+    // must be timed exactly (10-13uS for a 1 or a read, and 70uS to see
+    // the presence pulse) is done with interrupts off, so a slot can still
+    // delay an interrupt by up to 70uS. The low half of writing a 0 runs
+    // with them on, and an interrupt there stretches it: keep transactions
+    // clear of any interrupt handler that may run long enough to push the
+    // slot past the 120uS it allows.
+    // The 480uS reset pulse and the recovery after each slot are not
+    // waited for: async_poll() returns and expects to be called again.
+    // Calling it late only stretches those, which 1-Wire allows.
+    //
+    // Start a transaction. The buffers must stay valid until it is done.
+    // If 'power' is one the wire is held high after the last write, as
+    // for write(). Returns false if a transaction is already running.
+    bool async_start(bool reset, const uint8_t *wbuf, uint8_t wcount,
+                     uint8_t *rbuf, uint8_t rcount, bool power = 0);
+
+    // Run the current transaction if its next slot is due. Returns the
+    // microseconds until it should be called again, or 0 once the
+    // transaction is over. Call it from loop(), or from a timer interrupt
+    // reloaded with the result.
+    uint16_t async_poll(void);
+
+    // True while a transaction is running.
+    bool async_busy(void) { return async_phase != 0; }
+
+    // 1 if a device answered the reset of the last transaction. When
+    // none did, the rest of the transaction is skipped.
+    uint8_t async_presence(void) { return async_present; }
+#endif
+
 #if ONEWIRE_SEARCH
     // Clear the search state so that if will start from the beginning again.
     void reset_search();
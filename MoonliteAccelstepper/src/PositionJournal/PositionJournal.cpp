@@ -0,0 +1,89 @@
+// PositionJournal.cpp
+//
+// The motor position kept in EEPROM across resets, spread over many slots for wear
+
+#include "PositionJournal.h"
+#include "../OneWire/OneWire.h"
+#include <EEPROM.h>
+
+PositionJournal::PositionJournal(int address, uint8_t slots)
+    : _address(address),
+      _slots(slots < 2 ? 2 : slots),
+      _valid(false),
+      _slot(0),
+      _sequence(0),
+      _position(0)
+{
+}
+
+int PositionJournal::size(uint8_t slots)
+{
+    return slots * sizeof(Record);
+}
+
+uint8_t PositionJournal::crc(const Record& record)
+{
+    // The 1-Wire CRC, inverted so that erased EEPROM, all 0xff, does not pass
+    return ~OneWire::crc8((const uint8_t*)&record, offsetof(Record, crc));
+}
+
+boolean PositionJournal::read(uint8_t slot, Record& record)
+{
+    EEPROM.get(_address + slot * sizeof(Record), record);
+    return record.crc == crc(record);
+}
+
+boolean PositionJournal::load()
+{
+    // The run starts at slot 0, unless slot 0 was being overwritten when the power went,
+    // in which case the rest of the ring is the run from the time before
+    Record first;
+    uint8_t base = 0;
+    if (!read(base, first) && !read(++base, first))
+    {
+	_valid = false;
+	_position = 0;
+	return false;
+    }
+
+    // Slots from base up to the newest follow on from first. Later ones are
+    // from the time before round the ring, erased, or cut short.
+    uint8_t lo = base;
+    uint8_t hi = _slots - 1;
+    while (lo < hi)
+    {
+	uint8_t mid = lo + (hi - lo + 1) / 2;
+	Record record;
+	if (read(mid, record) && record.sequence == (uint16_t)(first.sequence + (mid - base)))
+	    lo = mid;
+	else
+	    hi = mid - 1;
+    }
+
+    Record newest;
+    read(lo, newest);
+    _valid = true;
+    _slot = lo;
+    _sequence = newest.sequence;
+    _position = newest.position;
+    return true;
+}
+
+void PositionJournal::save(long position)
+{
+    if (_valid && position == _position)
+	return;
+
+    Record record;
+    memset(&record, 0, sizeof(record));
+    record.position = position;
+    record.sequence = _valid ? _sequence + 1 : 0;
+    record.crc = crc(record);
+    uint8_t slot = _valid ? (_slot + 1) % _slots : 0;
+    EEPROM.put(_address + slot * sizeof(Record), record);
+
+    _valid = true;
+    _slot = slot;
+    _sequence = record.sequence;
+    _position = position;
+}
@@ -0,0 +1,81 @@
+// PositionJournal.h
+//
+// The motor position kept in EEPROM across resets, spread over many slots for wear
+
+#ifndef PositionJournal_h
+#define PositionJournal_h
+
+#include <stdlib.h>
+#include <stddef.h>
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#include <wiring.h>
+#endif
+
+/////////////////////////////////////////////////////////////////////
+/// \class PositionJournal PositionJournal.h <PositionJournal.h>
+/// \brief Remembers the motor position through a reset or power cut
+///
+/// Each save() appends a record of the position, a sequence number and a CRC to
+/// the next of a ring of slots in EEPROM, so each slot is written only once per
+/// time round the ring. An EEPROM cell lasts about 100000 writes, so a ring of n
+/// slots lasts about n * 100000 saves. Save when the motor has settled rather than
+/// while it moves; saving a position that has not changed writes nothing.
+///
+/// The newest record is the last of the run of consecutive sequence numbers that
+/// starts at slot 0, which load() finds by binary search, reading about log2(n)
+/// slots rather than all of them. A record cut short by a reset fails its CRC and
+/// ends the run, so load() returns the one before.
+class PositionJournal
+{
+public:
+    /// Constructor
+    /// \param[in] address Where the ring starts in EEPROM. It takes size(slots) bytes.
+    /// \param[in] slots Number of records in the ring, at least 2
+    PositionJournal(int address, uint8_t slots);
+
+    /// \param[in] slots Number of records in the ring
+    /// \return How many bytes of EEPROM the ring takes
+    static int size(uint8_t slots);
+
+    /// Finds the newest record
+    /// \return true if there is one, false if nothing has been saved
+    boolean load();
+
+    /// \return The position from the newest record, 0 if there is none
+    long    position() { return _position; }
+
+    /// Appends a record, if the position is not the one last saved or loaded.
+    /// Blocks for the EEPROM writes, about 3.3ms per changed byte on the AVR.
+    /// \param[in] position The motor position
+    void    save(long position);
+
+private:
+    /// A slot in EEPROM
+    struct Record
+    {
+	int32_t  position;
+	uint16_t sequence;
+	uint8_t  crc;
+    };
+
+    /// Reads a slot
+    /// \return true if its CRC is good
+    boolean read(uint8_t slot, Record& record);
+
+    /// \return The CRC over everything in the record but the crc itself
+    static uint8_t crc(const Record& record);
+
+    int     _address;
+    uint8_t _slots;
+    /// true once there is a record to follow on from
+    boolean _valid;
+    /// Slot, sequence number and position of the newest record
+    uint8_t _slot;
+    uint16_t _sequence;
+    long    _position;
+};
+
+#endif
@@ -0,0 +1,108 @@
+// RomTable.cpp
+//
+// The 1-Wire temperature sensors found on an earlier boot, kept in EEPROM
+
+#include "RomTable.h"
+#include <EEPROM.h>
+
+// 1-Wire commands
+#define READ_SCRATCHPAD 0xBE
+#define READ_POWER      0xB4
+
+// Temperature sensor family codes, as accepted by DallasTemperature::validFamily()
+#define DS18S20_FAMILY  0x10
+#define DS18B20_FAMILY  0x28
+#define DS1822_FAMILY   0x22
+#define DS1825_FAMILY   0x3B
+#define DS28EA00_FAMILY 0x42
+
+// Scratchpad length, the last byte being its CRC
+#define SCRATCHPAD_SIZE 9
+
+RomTable::RomTable(int address)
+    : _address(address)
+{
+    memset(&_table, 0, sizeof(_table));
+}
+
+int RomTable::size()
+{
+    return sizeof(Table);
+}
+
+uint8_t RomTable::crc()
+{
+    // Inverted so that erased EEPROM, all 0xff, does not pass
+    return ~OneWire::crc8((const uint8_t*)&_table, sizeof(_table) - 1);
+}
+
+boolean RomTable::load()
+{
+    EEPROM.get(_address, _table);
+    if (_table.count <= ROMTABLE_MAX && _table.crc == crc())
+	return true;
+    memset(&_table, 0, sizeof(_table));
+    return false;
+}
+
+void RomTable::save()
+{
+    _table.crc = crc();
+    EEPROM.put(_address, _table);
+}
+
+void RomTable::invalidate()
+{
+    int at = _address + offsetof(Table, crc);
+    EEPROM.update(at, ~EEPROM.read(at));
+}
+
+boolean RomTable::verify(OneWire& wire)
+{
+    if (!_table.count)
+	return false;
+    for (uint8_t i = 0; i < _table.count; i++)
+    {
+	// Nothing drives the bus for a missing sensor, so it reads all ones, which fails the CRC
+	uint8_t scratchpad[SCRATCHPAD_SIZE];
+	if (!wire.reset())
+	    return false;
+	wire.select(_table.roms[i]);
+	wire.write(READ_SCRATCHPAD);
+	wire.read_bytes(scratchpad, sizeof(scratchpad));
+	if (OneWire::crc8(scratchpad, SCRATCHPAD_SIZE - 1) != scratchpad[SCRATCHPAD_SIZE - 1])
+	    return false;
+    }
+    return true;
+}
+
+uint8_t RomTable::search(OneWire& wire)
+{
+    memset(&_table, 0, sizeof(_table));
+    uint8_t rom[8];
+    wire.reset_search();
+    while (_table.count < ROMTABLE_MAX && wire.search(rom))
+    {
+	if (OneWire::crc8(rom, 7) != rom[7])
+	    continue;
+	switch (rom[0])
+	{
+	    case DS18S20_FAMILY:
+	    case DS18B20_FAMILY:
+	    case DS1822_FAMILY:
+	    case DS1825_FAMILY:
+	    case DS28EA00_FAMILY:
+		memcpy(_table.roms[_table.count++], rom, 8);
+		break;
+	}
+    }
+
+    // A parasite powered sensor pulls the read slot after READ_POWER low
+    if (_table.count && wire.reset())
+    {
+	wire.skip();
+	wire.write(READ_POWER);
+	_table.parasite = !wire.read_bit();
+    }
+    return _table.count;
+}
@@ -0,0 +1,97 @@
+// RomTable.h
+//
+// The 1-Wire temperature sensors found on an earlier boot, kept in EEPROM
+
+#ifndef RomTable_h
+#define RomTable_h
+
+#include <stdlib.h>
+#include <stddef.h>
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#include <wiring.h>
+#endif
+
+#include "../OneWire/OneWire.h"
+
+/// Most ROM codes the table holds, 8 bytes of RAM and EEPROM each
+#ifndef ROMTABLE_MAX
+#define ROMTABLE_MAX 4
+#endif
+
+/////////////////////////////////////////////////////////////////////
+/// \class RomTable RomTable.h <RomTable.h>
+/// \brief Remembers which temperature sensors are on the bus between boots
+///
+/// Finding the sensors with a ROM search costs three time slots per address bit
+/// for each sensor, and DallasTemperature::begin() follows it with a scratchpad
+/// and power supply read per sensor, all before the sketch answers its first
+/// command. The sensors hardly ever change, so this keeps their ROM codes and
+/// power mode in EEPROM behind a CRC. On the next boot load() and verify() check
+/// that the table is intact and that each sensor still answers when addressed by
+/// MATCH_ROM; only when either fails does search() enumerate the bus again.
+///
+/// A sensor added to the bus is not noticed until the table is invalidated or
+/// one of the sensors it lists goes missing.
+class RomTable
+{
+public:
+    /// Constructor
+    /// \param[in] address Where the table starts in EEPROM. It takes size() bytes.
+    RomTable(int address);
+
+    /// \return How many bytes of EEPROM the table takes
+    static int size();
+
+    /// Reads the table from EEPROM
+    /// \return true if it was written by save() and is intact. If not, the table is left empty.
+    boolean load();
+
+    /// Writes the table to EEPROM. Bytes that have not changed are not rewritten.
+    void    save();
+
+    /// Spoils the copy in EEPROM so the next load() fails and the bus is searched again
+    void    invalidate();
+
+    /// Checks every sensor in the table is still there by reading its scratchpad with
+    /// MATCH_ROM and checking the CRC. Blocks for about 10ms per sensor.
+    /// \param[in] wire The bus the sensors are on
+    /// \return true if the table is not empty and every sensor answered
+    boolean verify(OneWire& wire);
+
+    /// Replaces the table with the temperature sensors found by a ROM search,
+    /// and whether any of them is parasite powered. Blocks for about 15ms per device.
+    /// \param[in] wire The bus to search
+    /// \return How many sensors were found
+    uint8_t search(OneWire& wire);
+
+    /// \return How many sensors are in the table
+    uint8_t count() { return _table.count; }
+
+    /// \param[in] i Sensor number, from 0 to count() - 1
+    /// \return The sensor's 8 byte ROM code
+    const uint8_t* rom(uint8_t i) { return _table.roms[i]; }
+
+    /// \return true if any sensor in the table is parasite powered
+    boolean parasite() { return _table.parasite; }
+
+private:
+    /// The layout in EEPROM
+    struct Table
+    {
+	uint8_t count;
+	uint8_t parasite;
+	uint8_t roms[ROMTABLE_MAX][8];
+	uint8_t crc;
+    };
+
+    /// \return The CRC over everything in the table but the crc itself
+    uint8_t crc();
+
+    int     _address;
+    Table   _table;
+};
+
+#endif
@@ -0,0 +1,262 @@
+// StepTimer.cpp
+//
+// Interrupt driven step generation for AccelStepper
+
+#include "StepTimer.h"
+
+// The timer being serviced by the ISR
+static StepTimer* activeTimer = 0;
+
+#if defined(__AVR__)
+#include <avr/interrupt.h>
+
+// Timer2 is clocked at F_CPU / 32
+#define US_TO_TICKS(us) ((us) / (32000000UL / F_CPU))
+#define TICKS_TO_US(ticks) ((unsigned long)(ticks) * (32000000UL / F_CPU))
+
+ISR(TIMER2_COMPA_vect)
+{
+    // The compare match cleared the counter, so it has counted up since the step was due.
+    // An interrupt held off for more than a whole compare period wraps it and reads short.
+    activeTimer->isr(TICKS_TO_US(TCNT2));
+}
+#endif
+
+StepTimer::StepTimer(AccelStepper& stepper)
+    : _stepper(&stepper),
+      _running(false),
+      _remaining(0),
+      _due(0),
+      _interval(0)
+{
+}
+
+void StepTimer::begin()
+{
+    activeTimer = this;
+#if defined(__AVR__)
+    noInterrupts();
+    TIMSK2 = 0;
+    TCCR2A = _BV(WGM21);            // CTC, no output compare pins
+    TCCR2B = _BV(CS21) | _BV(CS20); // clk/32
+    TCNT2 = 0;
+    interrupts();
+#endif
+}
+
+boolean StepTimer::run()
+{
+#if !defined(__AVR__)
+    // No hardware timer, emulate one against micros()
+    if (_running)
+    {
+	unsigned long late = micros() - _due;
+	if ((long)late >= 0)
+	    isr(late);
+    }
+#endif
+    return _running;
+}
+
+void StepTimer::isr(unsigned long late)
+{
+#if defined(__AVR__)
+    // Still counting down a long interval
+    if (_remaining)
+    {
+	load();
+	return;
+    }
+#endif
+
+    unsigned long interval = _stepper->runFromTimer(late);
+    if (!interval)
+    {
+#if defined(__AVR__)
+	TIMSK2 &= ~_BV(OCIE2A);
+#endif
+	_running = false;
+	return;
+    }
+
+#if defined(__AVR__)
+    _remaining = US_TO_TICKS(interval);
+    load();
+#else
+    // Advance by the interval rather than from now, so a late poll does not
+    // push every following step back. As with runSpeed(), a step a whole
+    // interval late is not caught up, the schedule restarts from it instead.
+    if (late >= _interval)
+	_due += late;
+    _due += interval;
+    _interval = interval;
+#endif
+}
+
+void StepTimer::load()
+{
+#if defined(__AVR__)
+    unsigned long chunk = _remaining;
+    if (chunk > 256)
+    {
+	// Dont leave a remainder too short to load
+	if (chunk - 256 < STEPTIMER_MIN_TICKS)
+	    chunk -= STEPTIMER_MIN_TICKS;
+	else
+	    chunk = 256;
+    }
+    if (chunk < STEPTIMER_MIN_TICKS)
+	chunk = STEPTIMER_MIN_TICKS;
+    _remaining = (chunk >= _remaining) ? 0 : _remaining - chunk;
+    OCR2A = chunk - 1;
+#endif
+}
+
+void StepTimer::start()
+{
+    noInterrupts();
+    if (!_running && _stepper->isRunning())
+    {
+	_running = true;
+	// The first step waits out its interval from the last step of the previous move, as it
+	// would with run(), so a move straight after another, such as a reversal, starts gently
+	unsigned long wait = _stepper->nextStepDelay();
+#if defined(__AVR__)
+	_remaining = US_TO_TICKS(wait);
+	TCNT2 = 0;
+	load();
+	TIFR2 = _BV(OCF2A);
+	TIMSK2 |= _BV(OCIE2A);
+#else
+	_due = micros() + wait;
+	// The first step starts the schedule, however late it is
+	_interval = 0;
+#endif
+    }
+    interrupts();
+}
+
+void StepTimer::moveTo(long absolute)
+{
+    noInterrupts();
+    _stepper->moveTo(absolute);
+    interrupts();
+    start();
+}
+
+void StepTimer::move(long relative)
+{
+    noInterrupts();
+    _stepper->move(relative);
+    interrupts();
+    start();
+}
+
+boolean StepTimer::queueMoveTo(long absolute)
+{
+    noInterrupts();
+    boolean ret = _stepper->queueMoveTo(absolute);
+    interrupts();
+    start();
+    return ret;
+}
+
+uint8_t StepTimer::queueLength()
+{
+    noInterrupts();
+    uint8_t ret = _stepper->queueLength();
+    interrupts();
+    return ret;
+}
+
+long StepTimer::queueEndPosition()
+{
+    noInterrupts();
+    long ret = _stepper->queueEndPosition();
+    interrupts();
+    return ret;
+}
+
+void StepTimer::clearQueue()
+{
+    noInterrupts();
+    _stepper->clearQueue();
+    interrupts();
+}
+
+void StepTimer::stop()
+{
+    noInterrupts();
+    _stepper->stop();
+    interrupts();
+}
+
+float StepTimer::speed()
+{
+    noInterrupts();
+    float ret = _stepper->speed();
+    interrupts();
+    return ret;
+}
+
+void StepTimer::setMaxSpeed(float speed)
+{
+    noInterrupts();
+    _stepper->setMaxSpeed(speed);
+    interrupts();
+    start();
+}
+
+void StepTimer::setAcceleration(float acceleration)
+{
+    noInterrupts();
+    _stepper->setAcceleration(acceleration);
+    interrupts();
+    start();
+}
+
+void StepTimer::setCurrentPosition(long position)
+{
+    noInterrupts();
+    _stepper->setCurrentPosition(position);
+    interrupts();
+}
+
+long StepTimer::currentPosition()
+{
+    noInterrupts();
+    long ret = _stepper->currentPosition();
+    interrupts();
+    return ret;
+}
+
+long StepTimer::targetPosition()
+{
+    noInterrupts();
+    long ret = _stepper->targetPosition();
+    interrupts();
+    return ret;
+}
+
+long StepTimer::distanceToGo()
+{
+    noInterrupts();
+    long ret = _stepper->distanceToGo();
+    interrupts();
+    return ret;
+}
+
+bool StepTimer::isRunning()
+{
+    return _running;
+}
+
+void StepTimer::enableOutputs()
+{
+    _stepper->enableOutputs();
+}
+
+void StepTimer::disableOutputs()
+{
+    _stepper->disableOutputs();
+}
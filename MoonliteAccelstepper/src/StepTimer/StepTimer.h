@@ -0,0 +1,149 @@
+// StepTimer.h
+//
+// Interrupt driven step generation for AccelStepper
+
+#ifndef StepTimer_h
+#define StepTimer_h
+
+#include <stdlib.h>
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#include <wiring.h>
+#endif
+
+#include "../AccelStepper/AccelStepper.h"
+
+/// Shortest interval the timer will be loaded with, in timer ticks. Keeps the
+/// compare value ahead of the counter when the ISR is entered late.
+#define STEPTIMER_MIN_TICKS 8
+
+/////////////////////////////////////////////////////////////////////
+/// \class StepTimer StepTimer.h <StepTimer.h>
+/// \brief Drive an AccelStepper from a hardware timer interrupt
+///
+/// Instead of polling run() from loop(), the step pulses are generated by a
+/// timer compare interrupt which calls AccelStepper::runFromTimer() and reloads
+/// the compare value with the next step interval. Serial handling, temperature
+/// reads etc in the foreground no longer stretch the step interval.
+///
+/// The foreground only queues targets and speeds through this class, which
+/// wraps the AccelStepper calls so they are atomic with respect to the ISR.
+/// The method names mirror AccelStepper so sketches can switch between the
+/// two with a single declaration.
+///
+/// On AVR this uses Timer2 in CTC mode with a /32 prescaler (2us ticks at 16MHz),
+/// so PWM on pins 3 and 11 and tone() are not available. Intervals longer than
+/// the 8 bit counter are split into several compare periods.
+/// On other architectures there is no timer: run() emulates one by comparing
+/// micros() against the absolute due time of the next step. This is also what
+/// is used when building on the host, so the ISR code path can be exercised
+/// against a simulated clock.
+///
+/// Only one StepTimer can be active at a time.
+class StepTimer
+{
+public:
+    /// Constructor
+    /// \param[in] stepper The stepper to drive. Do not call its run() functions directly.
+    StepTimer(AccelStepper& stepper);
+
+    /// Configure the timer hardware. Call from setup(), since the Arduino core
+    /// reinitialises the timers after static construction.
+    void    begin();
+
+    /// Service the emulated timer on architectures without a hardware timer.
+    /// Does nothing when the ISR is doing the stepping.
+    /// \return true if the motor is still running to the target position,
+    /// same as AccelStepper::run()
+    boolean run();
+
+    /// Set the target position and start the timer if it is idle
+    /// \param[in] absolute The desired absolute position.
+    void    moveTo(long absolute);
+
+    /// Set the target position relative to the current position
+    /// \param[in] relative The desired position relative to the current position.
+    void    move(long relative);
+
+    /// Add a target position to the stepper's queue and start the timer if it is idle,
+    /// see AccelStepper::queueMoveTo()
+    /// \param[in] absolute The desired absolute position.
+    /// \return true if it was queued, false if the queue is full
+    boolean queueMoveTo(long absolute);
+
+    /// \return the number of queued target positions, read atomically
+    uint8_t queueLength();
+
+    /// \return the last queued target position, read atomically
+    long    queueEndPosition();
+
+    /// Discards all queued target positions, see AccelStepper::clearQueue()
+    void    clearQueue();
+
+    /// Sets a target that stops as quickly as the acceleration allows, see AccelStepper::stop()
+    void    stop();
+
+    /// \return the current speed in steps per second, read atomically
+    float   speed();
+
+    /// Sets the maximum speed, see AccelStepper::setMaxSpeed()
+    /// \param[in] speed The desired maximum speed in steps per second.
+    void    setMaxSpeed(float speed);
+
+    /// Sets the acceleration, see AccelStepper::setAcceleration()
+    /// \param[in] acceleration The desired acceleration in steps per second per second.
+    void    setAcceleration(float acceleration);
+
+    /// Resets the current position, stopping any move in progress
+    /// \param[in] position The position in steps of wherever the motor happens to be right now.
+    void    setCurrentPosition(long position);
+
+    /// \return the current motor position, read atomically
+    long    currentPosition();
+
+    /// \return the target position, read atomically
+    long    targetPosition();
+
+    /// \return the distance from the current position to the target position, read atomically
+    long    distanceToGo();
+
+    /// \return true while the timer is generating steps
+    bool    isRunning();
+
+    /// Pass through to AccelStepper::enableOutputs()
+    void    enableOutputs();
+
+    /// Pass through to AccelStepper::disableOutputs()
+    void    disableOutputs();
+
+    /// Called by the timer interrupt. Not for use by sketches.
+    /// \param[in] late How far past its due time the step is, in microseconds. On AVR this is how long
+    /// the interrupt took to be entered, read from the counter.
+    void    isr(unsigned long late = 0);
+
+private:
+    /// Start the timer if it is not already running
+    void    start();
+
+    /// Load the compare register with the next chunk of _remaining
+    void    load();
+
+    /// The stepper being driven
+    AccelStepper*          _stepper;
+
+    /// True while the timer is enabled
+    volatile bool          _running;
+
+    /// Timer ticks left to wait before the next step
+    volatile unsigned long _remaining;
+
+    /// Absolute time in microseconds of the next step (emulated timer only)
+    unsigned long          _due;
+
+    /// The interval the next step was scheduled with, 0 for the first step of a move (emulated timer only)
+    unsigned long          _interval;
+};
+
+#endif
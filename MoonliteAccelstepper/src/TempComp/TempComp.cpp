@@ -0,0 +1,73 @@
+// TempComp.cpp
+//
+// Temperature compensation of the focus position
+
+#include "TempComp.h"
+
+TempComp::TempComp(int16_t coefficient, uint8_t deadband)
+    : _coefficient(coefficient),
+      _deadband(deadband ? deadband : 1),
+      _enabled(false),
+      _samples(0),
+      _ema(0),
+      _referenced(false),
+      _reference(0),
+      _applied(0)
+{
+}
+
+void TempComp::setCoefficient(int16_t coefficient)
+{
+    _coefficient = coefficient;
+    reference();
+}
+
+void TempComp::addSample(int16_t temperature)
+{
+    _recent[2] = _recent[1];
+    _recent[1] = _recent[0];
+    _recent[0] = temperature;
+
+    int16_t median = temperature;
+    if (_samples < 3)
+    {
+	// Not enough for a median yet, start the average at the first sample
+	if (!_samples++)
+	    _ema = (int32_t)temperature << TEMPCOMP_EMA_SHIFT;
+    }
+    else
+    {
+	int16_t a = _recent[0], b = _recent[1], c = _recent[2];
+	median = max(min(a, b), min(max(a, b), c));
+    }
+    _ema += median - (_ema >> TEMPCOMP_EMA_SHIFT);
+
+    if (!_referenced)
+	reference();
+}
+
+void TempComp::setEnabled(boolean enabled)
+{
+    if (enabled && !_enabled)
+	reference();
+    _enabled = enabled;
+}
+
+void TempComp::reference()
+{
+    _referenced = valid();
+    _reference = temperature();
+    _applied = 0;
+}
+
+long TempComp::correction()
+{
+    if (!_enabled || !_referenced)
+	return 0;
+
+    // Round to the nearest step, rather than towards 0
+    long scaled = (long)_coefficient * (temperature() - _reference);
+    long wanted = (scaled + (scaled < 0 ? -64 : 64)) / 128;
+    long steps = wanted - _applied;
+    return labs(steps) >= _deadband ? steps : 0;
+}
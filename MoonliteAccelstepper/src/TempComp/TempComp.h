@@ -0,0 +1,108 @@
+// TempComp.h
+//
+// Temperature compensation of the focus position
+
+#ifndef TempComp_h
+#define TempComp_h
+
+#include <stdlib.h>
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#include <wiring.h>
+#endif
+
+/// Smoothing of the median filtered temperature: each sample moves it 1/2^TEMPCOMP_EMA_SHIFT of
+/// the way, so it takes about that many samples to follow a change
+#ifndef TEMPCOMP_EMA_SHIFT
+#define TEMPCOMP_EMA_SHIFT 3
+#endif
+
+/////////////////////////////////////////////////////////////////////
+/// \class TempComp TempComp.h <TempComp.h>
+/// \brief Works out the moves that keep a focuser in focus as the temperature changes
+///
+/// Temperature samples go through a median of the last three, which throws out single
+/// bad readings, then an exponential moving average, which smooths out the sensor's
+/// quantisation and air currents. When compensation is enabled, or reference() is
+/// called after the focuser has been moved to a new focus, the filtered temperature
+/// is taken as the reference. From then on correction() gives how far to move to
+/// keep coefficient() steps per degree away from where the focuser was then.
+///
+/// Nothing is moved here. The caller moves the focuser when correction() is not 0,
+/// only while it is otherwise idle, and reports each move with applied().
+///
+/// Positions are in whatever steps the caller gives the coefficient in.
+class TempComp
+{
+public:
+    /// Constructor
+    /// \param[in] coefficient Steps to move out for each degree C the temperature rises
+    /// \param[in] deadband Smallest correction worth making, in steps
+    TempComp(int16_t coefficient = 0, uint8_t deadband = 1);
+
+    /// Sets the steps moved out for each degree C the temperature rises, negative to move in.
+    /// Takes the current temperature as the new reference.
+    void    setCoefficient(int16_t coefficient);
+
+    /// \return Steps moved out for each degree C the temperature rises
+    int16_t coefficient() { return _coefficient; }
+
+    /// Sets the smallest correction worth making, so the focuser does not hunt back
+    /// and forth over a step as the temperature wavers
+    /// \param[in] deadband Steps, at least 1
+    void    setDeadband(uint8_t deadband) { _deadband = deadband ? deadband : 1; }
+
+    /// \return The smallest correction made, in steps
+    uint8_t deadband() { return _deadband; }
+
+    /// Adds a temperature reading to the filter
+    /// \param[in] temperature 1/128 degrees C, as from TemperatureSampler::temperature()
+    void    addSample(int16_t temperature);
+
+    /// \return true once there has been a sample
+    boolean valid() { return _samples != 0; }
+
+    /// \return The filtered temperature in 1/128 degrees C
+    int16_t temperature() { return _ema >> TEMPCOMP_EMA_SHIFT; }
+
+    /// Turns compensation on or off. Turning it on takes the current temperature as the reference.
+    void    setEnabled(boolean enabled);
+
+    /// \return true if compensation is on
+    boolean enabled() { return _enabled; }
+
+    /// Takes the current temperature as the reference, or the next sample's if there is none yet.
+    /// Call it when the focuser has been moved to a new focus.
+    void    reference();
+
+    /// \return Steps to move to keep in focus, 0 if compensation is off, there is no
+    /// reference yet, or it is less than the deadband
+    long    correction();
+
+    /// Records a correction that has been made
+    /// \param[in] steps How far the focuser was moved, normally what correction() returned
+    void    applied(long steps) { _applied += steps; }
+
+private:
+    int16_t _coefficient;
+    uint8_t _deadband;
+    boolean _enabled;
+
+    /// Samples taken, up to 3
+    uint8_t _samples;
+    /// The last three samples, for the median
+    int16_t _recent[3];
+    /// Filtered temperature << TEMPCOMP_EMA_SHIFT
+    int32_t _ema;
+
+    /// true once _reference is set
+    boolean _referenced;
+    /// Filtered temperature when the focus was last set
+    int16_t _reference;
+    /// Steps moved since then
+    long    _applied;
+};
+
+#endif
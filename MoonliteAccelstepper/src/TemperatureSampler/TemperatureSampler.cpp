@@ -0,0 +1,220 @@
+// TemperatureSampler.cpp
+//
+// Background DS18B20 readout that never holds up the stepper for long
+
+#include "TemperatureSampler.h"
+
+// 1-Wire commands
+#define MATCH_ROM       0x55
+#define SKIP_ROM        0xCC
+#define CONVERT_T       0x44
+#define READ_SCRATCHPAD 0xBE
+
+// DS18S20 family code, which has a 9 bit temperature register
+#define DS18S20_FAMILY  0x10
+
+// DS18B20 range and power on value, in 1/16 degrees C
+#define RAW_MIN         (-55 * 16)
+#define RAW_MAX         (125 * 16)
+#define RAW_POWER_ON    (85 * 16)
+
+// Scratchpad layout
+#define TEMP_LSB        0
+#define TEMP_MSB        1
+#define COUNT_REMAIN    6
+#define COUNT_PER_C     7
+#define SCRATCHPAD_CRC  8
+
+TemperatureSampler::TemperatureSampler(OneWire& wire, unsigned long interval)
+    : _wire(&wire),
+      _interval(interval),
+      _count(0),
+      _skipRom(false),
+      _parasite(false),
+      _started(false),
+      _fullEvery(0),
+      _state(IDLE),
+      _current(0),
+      _reading(0),
+      _done(0),
+      _lastStart(0),
+      _lastPoll(0),
+      _converted(0),
+      _errors(0)
+{
+}
+
+boolean TemperatureSampler::addSensor(const uint8_t* address)
+{
+    if (_count >= TEMPERATURESAMPLER_MAX_SENSORS)
+	return false;
+    Sensor* sensor = &_sensors[_count++];
+    memcpy(sensor->address, address, sizeof(sensor->address));
+    sensor->temperature = 0;
+    sensor->time = 0;
+    sensor->sinceFull = NEVER_READ;
+    return true;
+}
+
+void TemperatureSampler::begin(boolean parasite)
+{
+    _parasite = parasite;
+    _started = _count != 0;
+    _state = IDLE;
+    _lastStart = millis() - _interval;
+    // Only starts the transaction, the rest of it is left to run()
+    run(false);
+}
+
+void TemperatureSampler::setTruncatedReads(uint8_t fullEvery)
+{
+    // sinceFull must not reach NEVER_READ
+    _fullEvery = fullEvery < NEVER_READ ? fullEvery : NEVER_READ - 1;
+    for (uint8_t i = 0; i < _count; i++)
+	if (_sensors[i].sinceFull != NEVER_READ)
+	    _sensors[i].sinceFull = 0;
+}
+
+boolean TemperatureSampler::run(boolean moving)
+{
+    if (!_started || moving)
+	return false;
+    // The next slot of the transaction in progress, if there is one
+    if (_wire->async_poll())
+	return false;
+
+    unsigned long now = millis();
+    switch (_state)
+    {
+	case IDLE:
+	    if (now - _lastStart < _interval)
+		return false;
+	    _lastStart = now;
+	    // Every sensor at once. A parasite powered one converts on power from the data line.
+	    _command[0] = SKIP_ROM;
+	    _command[1] = CONVERT_T;
+	    _wire->async_start(true, _command, 2, 0, 0, _parasite);
+	    _state = CONVERT;
+	    return false;
+
+	case CONVERT:
+	    if (!_wire->async_presence())
+	    {
+		_errors++;
+		_state = IDLE;
+		return false;
+	    }
+	    _lastPoll = now;
+	    _state = CONVERTING;
+	    return false;
+
+	case CONVERTING:
+	    if (_parasite)
+	    {
+		// It cannot be polled while the line is powering it
+		if (now - _lastPoll < TEMPERATURESAMPLER_PARASITE_MS)
+		    return false;
+		_wire->depower();
+	    }
+	    else
+	    {
+		if (now - _lastPoll < TEMPERATURESAMPLER_POLL_MS)
+		    return false;
+		_lastPoll = now;
+		// The sensors answer read slots with 0 until they are all done
+		_wire->async_start(false, 0, 0, &_done, 1);
+		_state = POLL;
+		return false;
+	    }
+	    // Fall through
+
+	case POLL:
+	    if (!_parasite && !_done)
+	    {
+		_state = CONVERTING;
+		return false;
+	    }
+	    _converted = now;
+	    _current = 0;
+	    startRead();
+	    return false;
+
+	case READ:
+	    if (!_wire->async_presence() || !finish(_reading == sizeof(_scratchpad)))
+	    {
+		// Make its next read a full one
+		_errors++;
+		if (_sensors[_current].sinceFull != NEVER_READ)
+		    _sensors[_current].sinceFull = 0;
+	    }
+	    return nextSensor();
+    }
+    return false;
+}
+
+boolean TemperatureSampler::nextSensor()
+{
+    if (++_current < _count)
+    {
+	startRead();
+	return false;
+    }
+    _state = IDLE;
+    return true;
+}
+
+void TemperatureSampler::startRead()
+{
+    Sensor* sensor = &_sensors[_current];
+    // A truncated read just stops after the temperature, the next reset ends it
+    boolean full = !_fullEvery || sensor->sinceFull == 0 || sensor->sinceFull >= _fullEvery
+	|| sensor->address[0] == DS18S20_FAMILY;
+    _reading = full ? sizeof(_scratchpad) : TEMP_MSB + 1;
+    uint8_t len;
+    if (_skipRom && _count == 1)
+    {
+	_command[0] = SKIP_ROM;
+	len = 1;
+    }
+    else
+    {
+	_command[0] = MATCH_ROM;
+	memcpy(&_command[1], sensor->address, 8);
+	len = 9;
+    }
+    _command[len++] = READ_SCRATCHPAD;
+    _wire->async_start(true, _command, len, _scratchpad, _reading);
+    _state = READ;
+}
+
+boolean TemperatureSampler::finish(boolean full)
+{
+    Sensor* sensor = &_sensors[_current];
+    if (full)
+    {
+	// A missing sensor reads as all ones, which fails the CRC
+	if (OneWire::crc8(_scratchpad, SCRATCHPAD_CRC) != _scratchpad[SCRATCHPAD_CRC])
+	    return false;
+	sensor->sinceFull = 1;
+    }
+    else
+    {
+	// No CRC to go on. The top 5 bits are all sign, and it has to be close to the last good reading.
+	int16_t raw = ((int16_t)_scratchpad[TEMP_MSB] << 8) | _scratchpad[TEMP_LSB];
+	uint8_t sign = _scratchpad[TEMP_MSB] & 0xf8;
+	int16_t step = raw - (sensor->temperature >> 3);
+	if ((sign != 0 && sign != 0xf8) || raw < RAW_MIN || raw > RAW_MAX || raw == RAW_POWER_ON
+	    || step > TEMPERATURESAMPLER_MAX_STEP || step < -TEMPERATURESAMPLER_MAX_STEP)
+	    return false;
+	sensor->sinceFull++;
+    }
+
+    // Same as DallasTemperature::calculateTemperature()
+    int16_t t = (((int16_t)_scratchpad[TEMP_MSB]) << 11) | (((int16_t)_scratchpad[TEMP_LSB]) << 3);
+    if (sensor->address[0] == DS18S20_FAMILY && _scratchpad[COUNT_PER_C] != 0)
+	t = ((t & 0xfff0) << 3) - 32
+	    + (((_scratchpad[COUNT_PER_C] - _scratchpad[COUNT_REMAIN]) << 7) / _scratchpad[COUNT_PER_C]);
+    sensor->temperature = t;
+    sensor->time = _converted;
+    return true;
+}
@@ -0,0 +1,172 @@
+// TemperatureSampler.h
+//
+// Background DS18B20 readout that never holds up the stepper for long
+
+#ifndef TemperatureSampler_h
+#define TemperatureSampler_h
+
+#include <stdlib.h>
+#if ARDUINO >= 100
+#include <Arduino.h>
+#else
+#include <WProgram.h>
+#include <wiring.h>
+#endif
+
+#include "../OneWire/OneWire.h"
+
+/// How often a parasite powered sensor is given to convert, in milliseconds.
+/// It cannot be polled since the line is held high to power it.
+#define TEMPERATURESAMPLER_PARASITE_MS 750
+
+/// How often a conversion in progress is polled, in milliseconds
+#define TEMPERATURESAMPLER_POLL_MS 10
+
+/// Largest change between readings a truncated read will accept, in 1/16 degrees C
+#define TEMPERATURESAMPLER_MAX_STEP 80
+
+/// Most sensors that can be read, 16 bytes of RAM each
+#ifndef TEMPERATURESAMPLER_MAX_SENSORS
+#define TEMPERATURESAMPLER_MAX_SENSORS 4
+#endif
+
+/////////////////////////////////////////////////////////////////////
+/// \class TemperatureSampler TemperatureSampler.h <TemperatureSampler.h>
+/// \brief Reads 1-Wire temperature sensors a little at a time from loop()
+///
+/// DallasTemperature::getTempC() resets the bus, selects the sensor and reads
+/// the whole scratchpad in one go, several milliseconds during which loop()
+/// does not get round to stepping. This class does the same work as a state
+/// machine on top of the OneWire asynchronous transactions: each call to run()
+/// does at most one time slot on the bus, so motion can be serviced between
+/// them. The results are kept for temperature() to return straight away.
+///
+/// Each batch starts a conversion on every sensor at once with a SKIP_ROM
+/// broadcast, polls until they have all finished, then reads each sensor in
+/// turn. The bus time is one conversion plus a short read per sensor. The
+/// readings of a batch all share the time of its conversion.
+///
+/// run() can be told to leave the bus alone while the motor is moving, picking up
+/// where it left off once it stops. Slots on the bus can be spaced out as much as needed.
+///
+/// Find the sensors' addresses in setup(), with RomTable or DallasTemperature,
+/// then hand them over with addSensor() and call begin().
+class TemperatureSampler
+{
+public:
+    /// Constructor
+    /// \param[in] wire The bus the sensors are on
+    /// \param[in] interval How often to take a batch of readings, in milliseconds
+    TemperatureSampler(OneWire& wire, unsigned long interval = 1000);
+
+    /// Adds a sensor to be read. Sensors are numbered in the order they are added.
+    /// \param[in] address The sensor's ROM address, copied
+    /// \return false if there are already TEMPERATURESAMPLER_MAX_SENSORS
+    boolean addSensor(const uint8_t* address);
+
+    /// \return How many sensors have been added
+    uint8_t sensors() { return _count; }
+
+    /// Starts sampling the sensors added so far, with the first conversion started straight away
+    /// \param[in] parasite true if any sensor is parasite powered, see DallasTemperature::isParasitePowerMode()
+    void    begin(boolean parasite = false);
+
+    /// Reads a single sensor with SKIP_ROM instead of MATCH_ROM and its address, which saves 8 bytes
+    /// on the bus for each read. Only right when it is the only device on the bus. Conversions are
+    /// always started with SKIP_ROM.
+    /// \param[in] skip true to use SKIP_ROM
+    void    setSkipRom(boolean skip) { _skipRom = skip; }
+
+    /// Reads just the two temperature bytes of the scratchpad most of the time, instead of all 9 and
+    /// its CRC. Without the CRC a truncated reading is only accepted if it is plausible: within the
+    /// DS18B20's range, not the 85C power on value, and within TEMPERATURESAMPLER_MAX_STEP of the
+    /// last reading. Otherwise it is discarded and that sensor's next read is a full one.
+    /// \param[in] fullEvery Do a full read with CRC every this many readings, to keep checking the
+    /// bus. 0 (the default) always does full reads.
+    void    setTruncatedReads(uint8_t fullEvery);
+
+    /// Does the next step of the readout, if any is due. Call from loop().
+    /// \param[in] moving true to leave the bus alone for now
+    /// \return true if a batch of readings has just been finished
+    boolean run(boolean moving);
+
+    /// \param[in] sensor Sensor number
+    /// \return true once a reading has been taken
+    boolean valid(uint8_t sensor = 0) { return sensor < _count && _sensors[sensor].sinceFull != NEVER_READ; }
+
+    /// \param[in] sensor Sensor number
+    /// \return The last good reading in 1/128 degrees C, as DallasTemperature::getTemp()
+    int16_t temperature(uint8_t sensor = 0) { return sensor < _count ? _sensors[sensor].temperature : 0; }
+
+    /// \param[in] sensor Sensor number
+    /// \return When the last good reading was converted, in milliseconds as millis()
+    unsigned long time(uint8_t sensor = 0) { return sensor < _count ? _sensors[sensor].time : 0; }
+
+    /// \return How many readouts have been discarded because a sensor did not answer, the CRC was wrong,
+    /// or a truncated reading was implausible
+    unsigned long errors() { return _errors; }
+
+private:
+    /// The steps of a batch
+    typedef enum
+    {
+	IDLE,       ///< Waiting for the next batch to be due
+	CONVERT,    ///< Starting a conversion on all the sensors
+	CONVERTING, ///< Waiting for the conversion
+	POLL,       ///< Asking the sensors if they have finished converting
+	READ        ///< Addressing a sensor and reading its scratchpad
+    } State;
+
+    /// sinceFull of a sensor that has no good reading yet
+    static const uint8_t NEVER_READ = 0xff;
+
+    /// What is known about each sensor
+    typedef struct
+    {
+	uint8_t        address[8];
+	int16_t        temperature;
+	unsigned long  time;
+	/// Readings since the last full one, 0 to make the next one full, NEVER_READ before the first
+	uint8_t        sinceFull;
+    } Sensor;
+
+    /// Starts reading the current sensor's scratchpad, all of it or just the temperature
+    void    startRead();
+
+    /// Moves on to the next sensor, or ends the batch
+    /// \return true if the batch is finished
+    boolean nextSensor();
+
+    /// Checks and converts the current sensor's scratchpad
+    /// \param[in] full true if all of it was read, false for just the temperature
+    /// \return true if it was good
+    boolean finish(boolean full);
+
+    OneWire*       _wire;
+    unsigned long  _interval;
+    Sensor         _sensors[TEMPERATURESAMPLER_MAX_SENSORS];
+    uint8_t        _count;
+    /// The ROM command, an address if it is MATCH_ROM, then the function command
+    uint8_t        _command[10];
+    boolean        _skipRom;
+    boolean        _parasite;
+    boolean        _started;
+    uint8_t        _fullEvery;
+
+    State          _state;
+    /// The sensor being read
+    uint8_t        _current;
+    /// Bytes of the scratchpad being read
+    uint8_t        _reading;
+    uint8_t        _scratchpad[9];
+    /// Read while converting, 0 until done
+    uint8_t        _done;
+    unsigned long  _lastStart;
+    unsigned long  _lastPoll;
+    /// When the conversion of this batch finished
+    unsigned long  _converted;
+
+    unsigned long  _errors;
+};
+
+#endif